@@ -4,108 +4,614 @@
 #include <bpf/bpf_tracing.h>
 #include <bpf/bpf_endian.h>
 #include "netlog.h"
+#include "netlog.bpf.h"
 
 char LICENSE[] SEC("license") = "Dual BSD/GPL";
 
-#define AF_INET  2
-#define AF_INET6 10
+/*
+ * Cau hinh luc load: netlog.c ghi vao skeleton giua open() va load(). Map
+ * .rodata bi freeze nen verifier coi day la hang so va cat bo han nhanh tat,
+ * probe khong ton them lenh nao cho tinh nang khong dung.
+ * Che do --top tat ring buffer va chi dem trong top_talkers, --scopes thi chi
+ * dem trong cgroup_stats/netns_stats, --flight chi ghi vao flight_ring.
+ * --flows them 1 record luc moi ket noi da ghi connect dong lai.
+ */
+const volatile bool emit_events = true;
+const volatile bool count_talkers = false;
+const volatile bool count_by_scope = false;
+const volatile bool capture_pkg = true;
+const volatile bool enable_ipv6 = true;
+const volatile bool use_cookie = false;  /* fentry/tp_btf/iter goi duoc bpf_get_socket_cookie */
+const volatile bool use_perfbuf = false; /* kernel khong co ring buffer */
+const volatile bool flight = false;      /* --flight: ghi vao flight_ring, khong gui */
+const volatile u32 flight_mask = FLIGHT_SLOTS_DEFAULT - 1;
+const volatile bool track_flows = false; /* --flows */
+const volatile u32 batch_max = 0;        /* != 0: --batch, gom toi da N event/record */
+const volatile u64 batch_age_ns = 0;
+const volatile u32 filter_uid = FILTER_UID_NONE;
+const volatile u16 filter_dport = 0;     /* 0 = khong loc */
+const volatile u64 filter_cgroup = 0;    /* 0 = khong loc, xem in_cgroup() */
+const volatile u32 filter_cgroup_level = 0;
+const volatile u32 heavy_thresh = 0;     /* != 0: --heavy, dem bang sketch */
+const volatile bool inbound = false;     /* --inbound: ghi ca accept */
 
-
-struct {
-	__uint(type, BPF_MAP_TYPE_RINGBUF);
-	__uint(max_entries, 256 * 1024);
-} events SEC(".maps");
-
-
-struct {
-	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
-	__uint(max_entries, 1);
-	__type(key, u32);
-	__type(value, struct event);
-} heap SEC(".maps");
-
-static __always_inline struct event *get_scratch_event(void)
+/* Cho dien event theo che do: slot flight_ring, slot batch hoac heap. */
+static __always_inline struct event *event_slot(void)
 {
-	u32 zero = 0;
-
-	return bpf_map_lookup_elem(&heap, &zero);
+	if (flight)
+		return flight_slot(flight_mask);
+	if (batch_max)
+		return batch_slot();
+	return get_scratch_event();
 }
 
+static __always_inline void event_commit(void *ctx, struct event *ev)
+{
+	if (flight)
+		flight_commit();
+	else if (batch_max)
+		batch_commit(batch_max, batch_age_ns);
+	else
+		submit_event(ctx, ev, use_perfbuf);
+}
 
-static __always_inline void read_pkg_name(struct event *ev, struct task_struct *task)
+/* Than chung cua connect (2 duong attach, netlog.c chon 1 luc khoi dong) va
+ * accept (--inbound): cung loc, sampling, dem va gioi han tren ring. cookie:
+ * program goi duoc bpf_get_socket_cookie (chi TRACING), xem new_flow_id(). */
+static __always_inline int handle_sock(void *ctx, struct sock *sk, u8 dir, bool cookie)
 {
-	struct mm_struct *mm = NULL;
-	unsigned long arg_start = 0, arg_end = 0;
-	long ret;
+	struct heavy_rec hr;
+	struct event *ev;
+	u16 weight = 0;
+	u32 est = 0, epoch = 0;
 
-	BPF_CORE_READ_INTO(&mm, task, mm);
-	if (!mm)
-		goto fallback;
+	if (!sk)
+		return 0;
+	/* Cung nam trong .rodata da pin: warm start voi --inbound khac lan
+	 * truoc bi memcmp trong pin_reuse() tu choi. */
+	if (dir == DIR_IN && !inbound)
+		return 0;
 
-	BPF_CORE_READ_INTO(&arg_start, mm, arg_start);
-	BPF_CORE_READ_INTO(&arg_end, mm, arg_end);
+	if (filter_uid != FILTER_UID_NONE &&
+	    (u32)bpf_get_current_uid_gid() != filter_uid)
+		return 0;
+	if (filter_cgroup && !in_cgroup(filter_cgroup, filter_cgroup_level))
+		return 0;
 
-	if (!arg_start || arg_end <= arg_start)
-		goto fallback;
+	/* Quyet dinh som de connect bi bo khong ton read_pkg_name. top_talkers
+	 * va cac map dem theo scope van dem moi connect nen khong bi sampling. */
+	if (emit_events)
+		weight = sample_weight();
+	if (!weight && !count_talkers && !count_by_scope && !heavy_thresh)
+		return 0;
 
-	ret = bpf_probe_read_user_str(ev->pkg_name, sizeof(ev->pkg_name), (void *)arg_start);
+	ev = event_slot();
+	if (!ev)
+		return 0;
 
+	if (fill_sock(ev, sk, enable_ipv6))
+		return 0;
+	/* --dport loc theo port dich vu: phia accept la port local. */
+	if (filter_dport && (dir == DIR_IN ? ev->sport : ev->dport) != filter_dport)
+		return 0;
+	ev->dir = dir;
+	/* --heavy: flow chua vuot nguong thi chi ton sketch, khong doc pkg. */
+	if (heavy_thresh) {
+		est = cms_count(ev, &epoch);
+		if (est < heavy_thresh)
+			return 0;
+	}
+	/* Chi dem theo scope thi khong can pkg. */
+	fill_task(ev, capture_pkg && (weight || count_talkers || heavy_thresh));
+	ev->weight = weight;
 
-	if (ret > 1)
-		return;
+	if (heavy_thresh) {
+		talker_key_fill(&hr.key, ev);
+		hr.count = est;
+		hr.cpu = bpf_get_smp_processor_id();
+		hr.epoch = epoch;
+		if (use_perfbuf)
+			bpf_perf_event_output(ctx, &events_perf, BPF_F_CURRENT_CPU, &hr, sizeof(hr));
+		else
+			bpf_ringbuf_output(&events, &hr, sizeof(hr), 0);
+		return 0;
+	}
+	if (count_talkers)
+		count_talker(ev);
+	if (count_by_scope)
+		count_scopes(ev);
+	if (!weight)
+		return 0;
 
-fallback:
-	__builtin_memset(ev->pkg_name, 0, sizeof(ev->pkg_name));
-	bpf_get_current_comm(ev->pkg_name, sizeof(ev->comm));
+	ev->flow_id = new_flow_id(sk, cookie);
+	if (track_flows)
+		flow_track(ev);
+	event_commit(ctx, ev);
+	return 0;
 }
 
 SEC("kprobe/tcp_connect")
 int BPF_KPROBE(bpf_prog_tcp_connect, struct sock *sk)
 {
-	struct event *ev, *rb_ev;
-	struct task_struct *task;
+	return handle_sock(ctx, sk, DIR_OUT, false);
+}
+
+/*
+ * --inbound: socket moi tra ve tu accept(), chay trong task goi accept nen
+ * pid/uid/pkg la cua ung dung dang nghe. kretprobe thay vi fexit: prototype
+ * inet_csk_accept doi tu 6.10, va fexit tren arm64 can >= 6.0. Ham chung
+ * cho ca DCCP nen loc IPPROTO_TCP.
+ */
+SEC("kretprobe/inet_csk_accept")
+int BPF_KRETPROBE(bpf_prog_tcp_accept, struct sock *sk)
+{
+	if (!sk || BPF_CORE_READ(sk, sk_protocol) != IPPROTO_TCP)
+		return 0;
+	return handle_sock(ctx, sk, DIR_IN, false);
+}
+
+/*
+ * Snapshot luc khoi dong (>= 5.9): moi socket TCP trong netns cua netlog, ghi
+ * struct event vao seq_file cua iterator, netlog.c doc qua fd. Chi full socket
+ * (bo TIME_WAIT va request sock: khong co uid). Khong co task nen pid/comm
+ * rong, pkg lay tu packages.list neu co.
+ */
+SEC("iter/tcp")
+int bpf_iter_tcp(struct bpf_iter__tcp *ctx)
+{
+	struct sock_common *skc = ctx->sk_common;
+	struct event ev;
+	struct sock *sk;
 
+	if (!skc)
+		return 0;
+	sk = (struct sock *)bpf_skc_to_tcp_sock(skc);
 	if (!sk)
 		return 0;
+	if (fill_sock(&ev, sk, enable_ipv6))
+		return 0;
+	if (filter_dport && ev.dport != filter_dport)
+		return 0;
+	ev.uid = BPF_CORE_READ(sk, sk_uid.val);
+	if (filter_uid != FILTER_UID_NONE && ev.uid != filter_uid)
+		return 0;
+	ev.state = BPF_CORE_READ(sk, __sk_common.skc_state);
+	ev.kind = EVENT_SNAPSHOT;
+	ev.weight = 1;
+	ev.ts_ns = bpf_ktime_get_boot_ns();
+	ev.flow_id = sk_flow_id(sk, use_cookie);
+	bpf_seq_write(ctx->meta->seq, &ev, sizeof(ev));
+	return 0;
+}
 
-	ev = get_scratch_event();
-	if (!ev)
+/* Trampoline: khong qua exception nhu kprobe (arm64 khong co kprobe toi uu),
+ * can BTF va kernel ho tro (arm64 >= 6.0). */
+SEC("fentry/tcp_connect")
+int BPF_PROG(bpf_prog_tcp_connect_fentry, struct sock *sk)
+{
+	return handle_sock(ctx, sk, DIR_OUT, use_cookie);
+}
+
+/*
+ * --flows: moi lan socket doi trang thai (>= 4.16), chi xu ly khi sang
+ * TCP_CLOSE va socket co trong open_flows (connect da ghi, da qua loc va
+ * sampling). Bytes/RTT/retrans lay tu counter kernel giu san trong tcp_sock,
+ * khong can hook theo goi. Ca ket noi that bai (SYN_SENT -> CLOSE) cung co
+ * record, bytes = 0.
+ */
+static __always_inline int flow_close(void *ctx, struct sock *sk, int newstate, bool cookie)
+{
+	struct tcp_sock *tp = (struct tcp_sock *)sk;
+	struct flow_rec *fr;
+	u64 id, key = (u64)sk, now;
+
+	if (newstate != TCP_CLOSE)
+		return 0;
+	id = sk_flow_id(sk, cookie);
+	if (!id)
+		return 0;
+	fr = bpf_map_lookup_elem(&open_flows, &id);
+	if (!fr)
 		return 0;
 
-	__builtin_memset(ev, 0, sizeof(*ev));
+	now = bpf_ktime_get_boot_ns();
+	fr->st.duration_ns = now - fr->ts_ns;
+	fr->ts_ns = now;
+	fr->st.bytes_sent = BPF_CORE_READ(tp, bytes_sent);
+	fr->st.bytes_acked = BPF_CORE_READ(tp, bytes_acked);
+	fr->st.bytes_received = BPF_CORE_READ(tp, bytes_received);
+	fr->st.srtt_us = BPF_CORE_READ(tp, srtt_us) >> 3;
+	fr->st.total_retrans = BPF_CORE_READ(tp, total_retrans);
+	if (use_perfbuf)
+		bpf_perf_event_output(ctx, &events_perf, BPF_F_CURRENT_CPU, fr, sizeof(*fr));
+	else
+		bpf_ringbuf_output(&events, fr, sizeof(*fr), 0);
 
-	ev->pid = bpf_get_current_pid_tgid() >> 32;
-	ev->uid = (u32)bpf_get_current_uid_gid();
-	bpf_get_current_comm(ev->comm, sizeof(ev->comm));
+	bpf_map_delete_elem(&open_flows, &id);
+	if (!cookie)
+		bpf_map_delete_elem(&flow_ids, &key);
+	return 0;
+}
 
-	task = (struct task_struct *)bpf_get_current_task();
-	read_pkg_name(ev, task);
+/* Di cung connect qua kprobe: flow id lay tu flow_ids. */
+SEC("raw_tp/inet_sock_set_state")
+int BPF_PROG(bpf_prog_tcp_close, struct sock *sk, int oldstate, int newstate)
+{
+	return flow_close(ctx, sk, newstate, false);
+}
 
-	BPF_CORE_READ_INTO(&ev->family, sk, __sk_common.skc_family);
-	BPF_CORE_READ_INTO(&ev->sport, sk, __sk_common.skc_num);
-	BPF_CORE_READ_INTO(&ev->dport, sk, __sk_common.skc_dport);
-	ev->dport = bpf_ntohs(ev->dport);
+/* Di cung connect qua fentry khi co cookie: raw_tp khong goi duoc helper. */
+SEC("tp_btf/inet_sock_set_state")
+int BPF_PROG(bpf_prog_tcp_close_btf, struct sock *sk, int oldstate, int newstate)
+{
+	return flow_close(ctx, sk, newstate, use_cookie);
+}
 
-	if (ev->family == AF_INET) {
-		BPF_CORE_READ_INTO(&ev->saddr_v4, sk, __sk_common.skc_rcv_saddr);
-		BPF_CORE_READ_INTO(&ev->daddr_v4, sk, __sk_common.skc_daddr);
-	} else if (ev->family == AF_INET6) {
-		BPF_CORE_READ_INTO(&ev->saddr_v6, sk, __sk_common.skc_v6_rcv_saddr);
-		BPF_CORE_READ_INTO(&ev->daddr_v6, sk, __sk_common.skc_v6_daddr);
-	} else {
-	
+/*
+ * Flush batch cu tren CPU dang chay, thay bpf_timer (>= 5.15). netlog.c goi
+ * bang BPF_PROG_TEST_RUN voi BPF_F_TEST_RUN_ON_CPU (raw_tp, >= 5.10) cho CPU
+ * nao co batch_ts qua --batch-age. Chay trong IPI nen co the chen giua luc
+ * probe dang dien slot: busy thi bo qua. ctx->args[0] != 0: flush ca batch
+ * chua du tuoi (luc thoat). Khong attach vao dau.
+ */
+SEC("raw_tp")
+int bpf_prog_batch_flush(struct bpf_raw_tracepoint_args *ctx)
+{
+	struct batch_stage *st;
+	u32 zero = 0;
+	u64 *first;
+
+	st = bpf_map_lookup_elem(&batch_stage, &zero);
+	first = bpf_map_lookup_elem(&batch_ts, &zero);
+	if (!st || !first || st->busy || !st->b.n)
+		return 0;
+	if (!ctx->args[0] && bpf_ktime_get_boot_ns() - *first < batch_age_ns)
 		return 0;
+	batch_flush(st, first);
+	return 1;
+}
+
+/*
+ * --usage: dem moi goi qua cgroup (netlog.c attach vao goc cgroup2 hoac
+ * --cgroup). Moi goi chi 1 lookup + cong tai cho, lan dau cua 1 key them 1
+ * update; khong dung ring buffer. Luon cho goi di qua (return 1).
+ */
+static __always_inline void count_usage(struct __sk_buff *skb, bool egress)
+{
+	struct usage_key key = {};
+	struct usage_val *v, zero = {};
+	struct bpf_sock *sk;
+
+	key.uid = bpf_get_socket_uid(skb);
+	sk = skb->sk;
+	if (sk) {
+		sk = bpf_sk_fullsock(sk);
+		if (sk)
+			key.proto = sk->protocol;
+	}
+
+	v = bpf_map_lookup_elem(&usage_stats, &key);
+	if (!v) {
+		bpf_map_update_elem(&usage_stats, &key, &zero, BPF_NOEXIST);
+		v = bpf_map_lookup_elem(&usage_stats, &key);
+		if (!v)
+			return;
+	}
+	if (egress) {
+		v->tx_bytes += skb->len;
+		v->tx_pkts++;
+	} else {
+		v->rx_bytes += skb->len;
+		v->rx_pkts++;
 	}
+}
 
+SEC("cgroup_skb/ingress")
+int bpf_prog_usage_ingress(struct __sk_buff *skb)
+{
+	count_usage(skb, false);
+	return 1;
+}
 
-	rb_ev = bpf_ringbuf_reserve(&events, sizeof(*ev), 0);
-	if (!rb_ev) {
-		bpf_printk("[NetLog] ringbuf full, drop pid=%d\n", ev->pid);
-		return 0;
+SEC("cgroup_skb/egress")
+int bpf_prog_usage_egress(struct __sk_buff *skb)
+{
+	count_usage(skb, true);
+	return 1;
+}
+
+/*
+ * --retrans: dem gui lai va RST theo (uid cua socket, daddr, dport) ngay
+ * trong kernel, khong gui event nao: bao gui lai la luc it chiu noi nhat.
+ * uid lay tu sk vi tracepoint chay trong softirq/timer, khong phai task.
+ */
+#define DEST_RETRANS  0
+#define DEST_RST_SENT 1
+#define DEST_RST_RECV 2
+
+static __always_inline void count_dest(const struct sock *sk, int what)
+{
+	struct dest_key key;
+	struct dest_val *v, zero = {};
+
+	/* tcp_send_reset cho goi khong thuoc socket nao: sk = NULL. */
+	if (!sk)
+		return;
+	__builtin_memset(&key, 0, sizeof(key));
+	BPF_CORE_READ_INTO(&key.family, sk, __sk_common.skc_family);
+	if (key.family == AF_INET)
+		BPF_CORE_READ_INTO(key.daddr, sk, __sk_common.skc_daddr);
+	else if (enable_ipv6 && key.family == AF_INET6)
+		BPF_CORE_READ_INTO(key.daddr, sk, __sk_common.skc_v6_daddr);
+	else
+		return;
+	BPF_CORE_READ_INTO(&key.dport, sk, __sk_common.skc_dport);
+	key.dport = bpf_ntohs(key.dport);
+	key.uid = BPF_CORE_READ(sk, sk_uid.val);
+	if (filter_uid != FILTER_UID_NONE && key.uid != filter_uid)
+		return;
+	if (filter_dport && key.dport != filter_dport)
+		return;
+
+	v = bpf_map_lookup_elem(&dest_stats, &key);
+	if (!v) {
+		bpf_map_update_elem(&dest_stats, &key, &zero, BPF_NOEXIST);
+		v = bpf_map_lookup_elem(&dest_stats, &key);
+		if (!v)
+			return;
 	}
+	if (what == DEST_RETRANS)
+		v->retrans++;
+	else if (what == DEST_RST_SENT)
+		v->rst_sent++;
+	else
+		v->rst_recv++;
+}
 
-	__builtin_memcpy(rb_ev, ev, sizeof(*ev));
-	bpf_ringbuf_submit(rb_ev, 0);
+SEC("raw_tp/tcp_retransmit_skb")
+int BPF_PROG(bpf_prog_tcp_retrans, const struct sock *sk, const struct sk_buff *skb)
+{
+	count_dest(sk, DEST_RETRANS);
+	return 0;
+}
 
+SEC("raw_tp/tcp_send_reset")
+int BPF_PROG(bpf_prog_tcp_send_reset, const struct sock *sk, const struct sk_buff *skb)
+{
+	count_dest(sk, DEST_RST_SENT);
 	return 0;
 }
+
+SEC("raw_tp/tcp_receive_reset")
+int BPF_PROG(bpf_prog_tcp_recv_reset, struct sock *sk)
+{
+	count_dest(sk, DEST_RST_RECV);
+	return 0;
+}
+
+/*
+ * --udp: UDP (va QUIC) khong co connect() bat buoc nen bat o duong gui,
+ * cgroup_skb egress (netlog.c attach nhu --usage). Chi datagram dau tien toi
+ * moi (socket, dich) ra event: dich tim lai trong udp_seen gan tren socket,
+ * sau goi dau chi con doc header de tinh hash va 1 lan bpf_sk_storage_get.
+ * uid, loc va dien event chi khi dich chua co; dich chi duoc nho sau khi
+ * event da gui (datagram bi sampling bo thi goi sau van co co hoi). cgroup_skb
+ * khong co task: pid/comm rong, pkg lay tu -k theo uid cua socket.
+ */
+#define ETH_P_IP   0x0800
+#define ETH_P_IPV6 0x86DD
+
+struct udp_dst {
+	u16 family;
+	u16 sport;
+	u16 dport;
+	u8  saddr[16];
+	u8  daddr[16];
+};
+
+/* skb cgroup bat dau o IP header. Chi lay phan dau, IPv6 co extension
+ * header thi bo qua. Tra ve offset cua UDP header, < 0 neu khong phai UDP. */
+static __always_inline int udp_parse(struct __sk_buff *skb, struct udp_dst *d)
+{
+	u16 ports[2];
+	u32 off;
+
+	if (skb->protocol == bpf_htons(ETH_P_IP)) {
+		struct iphdr ip;
+
+		if (bpf_skb_load_bytes(skb, 0, &ip, sizeof(ip)) ||
+		    ip.protocol != IPPROTO_UDP || ip.frag_off & bpf_htons(0x1fff))
+			return -1;
+		d->family = AF_INET;
+		__builtin_memcpy(d->saddr, &ip.saddr, 4);
+		__builtin_memcpy(d->daddr, &ip.daddr, 4);
+		off = ip.ihl * 4;
+	} else if (enable_ipv6 && skb->protocol == bpf_htons(ETH_P_IPV6)) {
+		struct ipv6hdr ip6;
+
+		if (bpf_skb_load_bytes(skb, 0, &ip6, sizeof(ip6)) ||
+		    ip6.nexthdr != IPPROTO_UDP)
+			return -1;
+		d->family = AF_INET6;
+		__builtin_memcpy(d->saddr, &ip6.saddr, 16);
+		__builtin_memcpy(d->daddr, &ip6.daddr, 16);
+		off = sizeof(ip6);
+	} else {
+		return -1;
+	}
+	if (bpf_skb_load_bytes(skb, off, ports, sizeof(ports)))
+		return -1;
+	d->sport = bpf_ntohs(ports[0]);
+	d->dport = bpf_ntohs(ports[1]);
+	return off;
+}
+
+static __always_inline u32 udp_dst_hash(const struct udp_dst *d)
+{
+	const u32 *w = (const u32 *)d->daddr;
+	u32 h = d->dport, i;
+
+	for (i = 0; i < 4; i++)
+		h = (h ^ w[i]) * 0x9e3779b1;
+	/* 0 la slot trong. */
+	return (h ^ h >> 16) | 1;
+}
+
+SEC("cgroup_skb/egress")
+int bpf_prog_udp_egress(struct __sk_buff *skb)
+{
+	struct bpf_sock *sk = skb->sk;
+	struct udp_seen *seen;
+	struct udp_dst d = {};
+	struct event *ev;
+	u32 h, i, uid;
+	u16 weight;
+
+	if (!sk)
+		return 1;
+	sk = bpf_sk_fullsock(sk);
+	if (!sk || sk->protocol != IPPROTO_UDP)
+		return 1;
+	if (udp_parse(skb, &d) < 0)
+		return 1;
+	h = udp_dst_hash(&d);
+	seen = bpf_sk_storage_get(&udp_seen, sk, 0, BPF_SK_STORAGE_GET_F_CREATE);
+	if (!seen)
+		return 1;
+	for (i = 0; i < UDP_SEEN_DSTS; i++)
+		if (seen->dst[i] == h)
+			return 1;
+
+	if (filter_dport && d.dport != filter_dport)
+		return 1;
+	uid = bpf_get_socket_uid(skb);
+	if (filter_uid != FILTER_UID_NONE && uid != filter_uid)
+		return 1;
+	weight = sample_weight();
+	if (!weight)
+		return 1;
+	ev = event_slot();
+	if (!ev)
+		return 1;
+
+	__builtin_memset(ev, 0, sizeof(*ev));
+	ev->ts_ns = bpf_ktime_get_boot_ns();
+	ev->cgroup_id = bpf_skb_cgroup_id(skb);
+	ev->flow_id = bpf_get_socket_cookie(skb);
+	ev->uid = uid;
+	ev->family = d.family;
+	ev->sport = d.sport;
+	ev->dport = d.dport;
+	ev->weight = weight;
+	ev->kind = EVENT_CONNECT;
+	ev->proto = IPPROTO_UDP;
+	__builtin_memcpy(ev->saddr_v6, d.saddr, sizeof(d.saddr));
+	__builtin_memcpy(ev->daddr_v6, d.daddr, sizeof(d.daddr));
+	event_commit(skb, ev);
+	seen->dst[seen->next++ % UDP_SEEN_DSTS] = h;
+	return 1;
+}
+
+/*
+ * --dns: tra loi DNS qua UDP (port nguon 53) vao may, bat o cgroup_skb
+ * ingress (netlog.c attach nhu --udp). Tren Android tra loi ve netd, khong
+ * ve app, nen khong loc uid/port. Chi doc ban ghi A/AAAA trong phan answer:
+ * moi ban ghi 1 dns_rec (QNAME, dia chi, TTL) gui thang len ring, netlog.c
+ * giu cache dia chi -> ten. Vong lap co chan (>= 5.3); answer co ten khong
+ * nen (khong phai con tro 0xc0) thi dung doc.
+ */
+#define DNS_PORT        53
+#define DNS_LABELS_MAX  32
+#define DNS_ANSWERS_MAX 8
+#define DNS_TYPE_A      1
+#define DNS_TYPE_AAAA   28
+#define DNS_CLASS_IN    1
+
+struct dns_hdr {
+	u16 id;
+	u16 flags;
+	u16 qdcount;
+	u16 ancount;
+	u16 nscount;
+	u16 arcount;
+};
+
+struct dns_ans {
+	u16 name;       /* con tro nen */
+	u16 type;
+	u16 class;
+	u32 ttl;
+	u16 rdlen;
+} __attribute__((packed));
+
+SEC("cgroup_skb/ingress")
+int bpf_prog_dns_ingress(struct __sk_buff *skb)
+{
+	struct udp_dst d = {};
+	struct dns_rec r = {};
+	struct dns_hdr h;
+	struct dns_ans a;
+	u32 off, qname, n, i;
+	u16 rdlen;
+	int udp;
+	u8 len;
+
+	udp = udp_parse(skb, &d);
+	if (udp < 0 || d.sport != DNS_PORT)
+		return 1;
+	off = udp + sizeof(struct udphdr);
+	/* QR = 1 (tra loi), dung 1 cau hoi. */
+	if (bpf_skb_load_bytes(skb, off, &h, sizeof(h)) ||
+	    !(h.flags & bpf_htons(0x8000)) || h.qdcount != bpf_htons(1) || !h.ancount)
+		return 1;
+	off += sizeof(h);
+
+	qname = off;
+	for (i = 0; i < DNS_LABELS_MAX; i++) {
+		if (bpf_skb_load_bytes(skb, off, &len, 1) || len > 63)
+			return 1;
+		off += len + 1;
+		if (!len)
+			break;
+	}
+	if (i == DNS_LABELS_MAX)
+		return 1;
+	/* Bo qua cau hoi cho goc ("."), chi co byte 0. */
+	n = off - qname;
+	if (n > DNS_NAME_LEN)
+		n = DNS_NAME_LEN;
+	if (n < 2 || bpf_skb_load_bytes(skb, qname, r.name, n))
+		return 1;
+	off += 4;       /* QTYPE, QCLASS */
+
+	r.ts_ns = bpf_ktime_get_boot_ns();
+	for (i = 0; i < DNS_ANSWERS_MAX && i < bpf_ntohs(h.ancount); i++) {
+		if (bpf_skb_load_bytes(skb, off, &a, sizeof(a)) ||
+		    (a.name & bpf_htons(0xc000)) != bpf_htons(0xc000))
+			break;
+		off += sizeof(a);
+		rdlen = bpf_ntohs(a.rdlen);
+		if (a.class != bpf_htons(DNS_CLASS_IN))
+			goto next;
+		if (a.type == bpf_htons(DNS_TYPE_A) && rdlen == 4) {
+			r.family = AF_INET;
+			__builtin_memset(r.addr, 0, sizeof(r.addr));
+			if (bpf_skb_load_bytes(skb, off, r.addr, 4))
+				break;
+		} else if (enable_ipv6 && a.type == bpf_htons(DNS_TYPE_AAAA) && rdlen == 16) {
+			r.family = AF_INET6;
+			if (bpf_skb_load_bytes(skb, off, r.addr, 16))
+				break;
+		} else {
+			goto next;
+		}
+		r.ttl = bpf_ntohl(a.ttl);
+		if (use_perfbuf)
+			bpf_perf_event_output(skb, &events_perf, BPF_F_CURRENT_CPU, &r, sizeof(r));
+		else
+			bpf_ringbuf_output(&events, &r, sizeof(r), 0);
+next:
+		off += rdlen;
+	}
+	return 1;
+}
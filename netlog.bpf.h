@@ -0,0 +1,565 @@
+/*
+ * netlog.bpf.h - phan dung chung cua probe: map va cac buoc dung event.
+ * Duoc include boi netlog.bpf.c (kprobe that) va netlog_bench.bpf.c (raw_tp
+ * chay bang BPF_PROG_TEST_RUN) de benchmark dung dung code chay tren may.
+ */
+#ifndef __NETLOG_BPF_H
+#define __NETLOG_BPF_H
+
+#define AF_INET  2
+#define AF_INET6 10
+
+struct {
+	__uint(type, BPF_MAP_TYPE_RINGBUF);
+	__uint(max_entries, 256 * 1024);
+} events SEC(".maps");
+
+/* Kernel < 5.8 khong co ring buffer: netlog.c tat tao map events va dung map
+ * nay (max_entries = so CPU, libbpf tu dien). */
+struct {
+	__uint(type, BPF_MAP_TYPE_PERF_EVENT_ARRAY);
+	__uint(key_size, sizeof(u32));
+	__uint(value_size, sizeof(u32));
+} events_perf SEC(".maps");
+
+
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+	__uint(max_entries, 1);
+	__type(key, u32);
+	__type(value, struct event);
+} heap SEC(".maps");
+
+/* LRU de map day thi tu bo cac flow lau khong connect, khong mat flow moi. */
+struct {
+	__uint(type, BPF_MAP_TYPE_LRU_HASH);
+	__uint(max_entries, TOP_TALKERS_MAX);
+	__type(key, struct talker_key);
+	__type(value, u64);
+} top_talkers SEC(".maps");
+
+/* Dem connect theo container (cgroup v2) va theo netns, doc bang --scopes. */
+struct {
+	__uint(type, BPF_MAP_TYPE_LRU_HASH);
+	__uint(max_entries, SCOPE_STATS_MAX);
+	__type(key, u64);
+	__type(value, u64);
+} cgroup_stats SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_LRU_HASH);
+	__uint(max_entries, SCOPE_STATS_MAX);
+	__type(key, u32);
+	__type(value, u64);
+} netns_stats SEC(".maps");
+
+/*
+ * Flow id khi hook connect khong goi duoc bpf_get_socket_cookie (kprobe,
+ * kretprobe, hoac kernel < 5.12 / khong co fentry): tu sinh theo CPU (khong can atomic fetch) va nho theo con tro sk de cac
+ * hook sau tren cung socket lay lai dung id. Moi connect ghi de entry cu nen
+ * con tro sk duoc tai su dung khong mang id cu; LRU don entry cua socket da dong.
+ */
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+	__uint(max_entries, 1);
+	__type(key, u32);
+	__type(value, u64);
+} flow_seq SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_LRU_HASH);
+	__uint(max_entries, FLOW_IDS_MAX);
+	__type(key, u64);       /* dia chi struct sock */
+	__type(value, u64);
+} flow_ids SEC(".maps");
+
+/*
+ * --flows: ket noi da ghi connect ma chua dong, key la flow id. Gia tri la
+ * flow_rec dien san luc connect, luc dong chi them counter roi gui nguyen ban.
+ */
+struct {
+	__uint(type, BPF_MAP_TYPE_LRU_HASH);
+	__uint(max_entries, FLOW_IDS_MAX);
+	__type(key, u64);
+	__type(value, struct flow_rec);
+} open_flows SEC(".maps");
+
+/*
+ * --udp: cac dich (hash cua daddr, dport) socket UDP da gui toi, gan vao
+ * chinh socket nen kernel tu giai phong khi socket dong, khong can LRU. Socket
+ * gui toi nhieu dich hon UDP_SEEN_DSTS (DNS, STUN) thi quen dich cu nhat.
+ */
+#define UDP_SEEN_DSTS 4
+
+struct udp_seen {
+	u32 dst[UDP_SEEN_DSTS];        /* 0 = trong */
+	u32 next;
+};
+
+struct {
+	__uint(type, BPF_MAP_TYPE_SK_STORAGE);
+	__uint(map_flags, BPF_F_NO_PREALLOC);
+	__type(key, int);
+	__type(value, struct udp_seen);
+} udp_seen SEC(".maps");
+
+/*
+ * --flight: moi CPU giu N event gan nhat (--flight N), ghi de cai cu nhat.
+ * flight_head la so event da ghi xong tren CPU do; slot head & mask la slot
+ * dang (hoac sap) bi ghi nen user-space khong doc no. max_entries do netlog.c
+ * dat, khong o che do --flight thi 2 map khong duoc tao.
+ */
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+	__uint(max_entries, FLIGHT_SLOTS_DEFAULT);
+	__type(key, u32);
+	__type(value, struct event);
+} flight_ring SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+	__uint(max_entries, 1);
+	__type(key, u32);
+	__type(value, u64);
+} flight_head SEC(".maps");
+
+/*
+ * --batch: moi CPU gom event vao batch_stage roi gui ca batch bang 1 lan
+ * bpf_ringbuf_output(), thay vi reserve/submit (lock + producer_pos chung)
+ * cho tung event. batch_ts la ts_ns cua event dau trong batch (0 = rong),
+ * tach rieng de user-space doc re va biet CPU nao co batch cu can flush.
+ */
+struct batch_stage {
+	u32 busy;       /* dang dien ev[n]: flush tu user-space phai bo qua */
+	u32 pad;
+	struct event_batch b;
+};
+
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+	__uint(max_entries, 1);
+	__type(key, u32);
+	__type(value, struct batch_stage);
+} batch_stage SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+	__uint(max_entries, 1);
+	__type(key, u32);
+	__type(value, u64);
+} batch_ts SEC(".maps");
+
+/*
+ * --usage: cong don skb->len theo (uid, protocol), moi CPU mot ban nen
+ * khong can atomic; netlog.c cong cac CPU lai moi chu ky. LRU: uid het
+ * chay thi tu bi don.
+ */
+struct {
+	__uint(type, BPF_MAP_TYPE_LRU_PERCPU_HASH);
+	__uint(max_entries, USAGE_STATS_MAX);
+	__type(key, struct usage_key);
+	__type(value, struct usage_val);
+} usage_stats SEC(".maps");
+
+/* --retrans: gui lai/RST theo dich, per-CPU nhu usage_stats vi bao gui lai
+ * la luc nhieu CPU cung dem vao vai key. */
+struct {
+	__uint(type, BPF_MAP_TYPE_LRU_PERCPU_HASH);
+	__uint(max_entries, DEST_STATS_MAX);
+	__type(key, struct dest_key);
+	__type(value, struct dest_val);
+} dest_stats SEC(".maps");
+
+/* --heavy: CMS_DEPTH hang x CMS_WIDTH o lien nhau, per-CPU nen khong can
+ * atomic. Bo nho co dinh, khong phu thuoc so dich. */
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+	__uint(max_entries, CMS_DEPTH * CMS_WIDTH);
+	__type(key, u32);
+	__type(value, struct cms_cell);
+} cms SEC(".maps");
+
+/* netlog.c tang/giam rate theo do day ring buffer va do tre cua consumer.
+ * --heavy thi chi dung epoch. */
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(max_entries, 1);
+	__type(key, u32);
+	__type(value, struct sample_ctl);
+} sample_ctl SEC(".maps");
+
+static __always_inline struct event *get_scratch_event(void)
+{
+	u32 zero = 0;
+
+	return bpf_map_lookup_elem(&heap, &zero);
+}
+
+
+static __always_inline void read_pkg_name(struct event *ev, struct task_struct *task)
+{
+	struct mm_struct *mm = NULL;
+	unsigned long arg_start = 0, arg_end = 0;
+	long ret;
+
+	BPF_CORE_READ_INTO(&mm, task, mm);
+	if (!mm)
+		goto fallback;
+
+	BPF_CORE_READ_INTO(&arg_start, mm, arg_start);
+	BPF_CORE_READ_INTO(&arg_end, mm, arg_end);
+
+	if (!arg_start || arg_end <= arg_start)
+		goto fallback;
+
+	ret = bpf_probe_read_user_str(ev->pkg_name, sizeof(ev->pkg_name), (void *)arg_start);
+
+
+	if (ret > 1)
+		return;
+
+fallback:
+	__builtin_memset(ev->pkg_name, 0, sizeof(ev->pkg_name));
+	bpf_get_current_comm(ev->pkg_name, sizeof(ev->comm));
+}
+
+/*
+ * Tra ve weight cua event (0 = bo qua). Chon ngau nhien doc lap tung connect
+ * thay vi de ring buffer day roi rot theo thoi diem: tong weight cua cac event
+ * giu lai la uoc luong khong chech cua so connect that.
+ */
+static __always_inline u16 sample_weight(void)
+{
+	struct sample_ctl *ctl;
+	u32 zero = 0, rate;
+
+	ctl = bpf_map_lookup_elem(&sample_ctl, &zero);
+	rate = ctl ? ctl->rate : 1;
+	if (rate <= 1)
+		return 1;
+	if (bpf_get_prandom_u32() % rate)
+		return 0;
+	return rate;
+}
+
+static __always_inline void map_inc(void *map, const void *key)
+{
+	u64 one = 1, *cnt;
+
+	cnt = bpf_map_lookup_elem(map, key);
+	if (cnt) {
+		__sync_fetch_and_add(cnt, 1);
+		return;
+	}
+	/* CPU khac co the vua them cung key: NOEXIST fail thi cong vao ban do. */
+	if (bpf_map_update_elem(map, key, &one, BPF_NOEXIST)) {
+		cnt = bpf_map_lookup_elem(map, key);
+		if (cnt)
+			__sync_fetch_and_add(cnt, 1);
+	}
+}
+
+static __always_inline void talker_key_fill(struct talker_key *key, const struct event *ev)
+{
+	__builtin_memset(key, 0, sizeof(*key));
+	__builtin_memcpy(key->pkg_name, ev->pkg_name, sizeof(key->pkg_name));
+	__builtin_memcpy(key->daddr, ev->daddr_v6, sizeof(key->daddr));
+	/* Port cua phia accept: gom moi ket noi vao cung 1 dich vu. */
+	key->dport = ev->dir == DIR_IN ? ev->sport : ev->dport;
+	key->family = ev->family;
+	key->dir = ev->dir;
+}
+
+static __always_inline void count_talker(const struct event *ev)
+{
+	struct talker_key key;
+
+	talker_key_fill(&key, ev);
+	map_inc(&top_talkers, &key);
+}
+
+/*
+ * --heavy: them 1 connect vao sketch, tra ve uoc luong sau khi them va epoch
+ * cua chu ky. Moi o cua flow tang 1 nen min tang toi da 1, nhung flow moi
+ * trung o voi flow lon co the bat dau tren nguong. Key hash la uid thay cho
+ * pkg (khong phai doc argv khi chua vuot nguong). 0 neu khong doc duoc map.
+ */
+static __always_inline u32 cms_count(const struct event *ev, u32 *epoch_out)
+{
+	u32 zero = 0, epoch = 0, est = ~0U, h1, h2, i, idx;
+	struct sample_ctl *ctl;
+	struct cms_cell *c;
+
+	ctl = bpf_map_lookup_elem(&sample_ctl, &zero);
+	if (ctl)
+		epoch = ctl->epoch;
+	*epoch_out = epoch;
+	cms_hash((u32)bpf_get_current_uid_gid(), (const u32 *)ev->daddr_v6,
+		 (ev->dir == DIR_IN ? ev->sport : ev->dport) | (u32)ev->dir << 16, &h1, &h2);
+	for (i = 0; i < CMS_DEPTH; i++) {
+		idx = i * CMS_WIDTH + ((h1 + i * h2) & (CMS_WIDTH - 1));
+		c = bpf_map_lookup_elem(&cms, &idx);
+		if (!c)
+			return 0;
+		if (c->epoch != epoch) {
+			c->epoch = epoch;
+			c->count = 0;
+		}
+		if (++c->count < est)
+			est = c->count;
+	}
+	return est;
+}
+
+static __always_inline void count_scopes(const struct event *ev)
+{
+	map_inc(&cgroup_stats, &ev->cgroup_id);
+	map_inc(&netns_stats, &ev->netns);
+}
+
+/*
+ * Hai dang cua struct cgroup cho CO-RE: kernel < 6.2 co ancestor_ids[],
+ * 6.2 tro di thay bang ancestors[] (con tro cgroup, id nam o kn->id).
+ */
+struct cgroup___old {
+	int level;
+	u64 ancestor_ids[];
+} __attribute__((preserve_access_index));
+
+struct cgroup___new {
+	int level;
+	struct cgroup *ancestors[];
+} __attribute__((preserve_access_index));
+
+/*
+ * Task hien tai co nam trong cgroup id (o muc level cua cay cgroup v2) hoac
+ * cgroup con cua no khong. Kprobe tren 5.10 chua co
+ * bpf_get_current_ancestor_cgroup_id nen doc thang mang to tien cua cgroup.
+ */
+static __always_inline bool in_cgroup(u64 id, u32 level)
+{
+	struct task_struct *task = (struct task_struct *)bpf_get_current_task();
+	struct cgroup___old *old;
+	struct cgroup *cgrp;
+	u64 anc = 0;
+	int cur;
+
+	cgrp = BPF_CORE_READ(task, cgroups, dfl_cgrp);
+	if (!cgrp)
+		return false;
+	cur = BPF_CORE_READ(cgrp, level);
+	if (cur < (int)level)
+		return false;
+	old = (void *)cgrp;
+	if (bpf_core_field_exists(old->ancestor_ids))
+		bpf_probe_read_kernel(&anc, sizeof(anc), &old->ancestor_ids[level]);
+	else
+		anc = BPF_CORE_READ((struct cgroup___new *)cgrp, ancestors[level], kn, id);
+	return anc == id;
+}
+
+/*
+ * Cap flow id moi cho sk luc connect. use_cookie la hang so luc load: chi
+ * program TRACING (fentry, tp_btf, iter) duoc goi bpf_get_socket_cookie voi
+ * struct sock *, program khac truyen false va nhanh do bi verifier bo.
+ */
+static __always_inline u64 new_flow_id(struct sock *sk, bool use_cookie)
+{
+	u64 key = (u64)sk, id, *seq;
+	u32 zero = 0;
+
+	if (use_cookie)
+		return bpf_get_socket_cookie(sk);
+
+	seq = bpf_map_lookup_elem(&flow_seq, &zero);
+	if (!seq)
+		return 0;
+	id = FLOW_ID_LOCAL | ((u64)bpf_get_smp_processor_id() << 48) |
+	     (++*seq & ((1ULL << 48) - 1));
+	bpf_map_update_elem(&flow_ids, &key, &id, BPF_ANY);
+	return id;
+}
+
+/* Flow id cua socket da connect truoc do (hook sau connect), 0 = khong biet. */
+static __always_inline u64 sk_flow_id(struct sock *sk, bool use_cookie)
+{
+	u64 key = (u64)sk, *id;
+
+	if (use_cookie)
+		return bpf_get_socket_cookie(sk);
+
+	id = bpf_map_lookup_elem(&flow_ids, &key);
+	return id ? *id : 0;
+}
+
+static __always_inline void flow_track(const struct event *ev)
+{
+	struct flow_rec fr;
+
+	__builtin_memset(&fr, 0, sizeof(fr));
+	fr.ts_ns = ev->ts_ns;
+	fr.cgroup_id = ev->cgroup_id;
+	fr.flow_id = ev->flow_id;
+	fr.pid = ev->pid;
+	fr.uid = ev->uid;
+	fr.netns = ev->netns;
+	fr.family = ev->family;
+	fr.sport = ev->sport;
+	fr.dport = ev->dport;
+	fr.weight = ev->weight;
+	fr.dir = ev->dir;
+	__builtin_memcpy(fr.saddr_v6, ev->saddr_v6, sizeof(fr.saddr_v6));
+	__builtin_memcpy(fr.daddr_v6, ev->daddr_v6, sizeof(fr.daddr_v6));
+	__builtin_memcpy(fr.comm, ev->comm, sizeof(fr.comm));
+	bpf_map_update_elem(&open_flows, &fr.flow_id, &fr, BPF_ANY);
+}
+
+/*
+ * Dien phan lay tu sk, truoc phan task: loc theo family/port xong moi phai tra
+ * tien read_pkg_name. Tra ve -1 neu family khong ho tro (hoac IPv6 bi tat).
+ * Tham so bool la hang so luc load (.rodata) nen verifier bo han nhanh tat.
+ */
+static __always_inline int fill_sock(struct event *ev, struct sock *sk, bool with_ipv6)
+{
+	__builtin_memset(ev, 0, sizeof(*ev));
+
+	ev->proto = IPPROTO_TCP;
+	BPF_CORE_READ_INTO(&ev->family, sk, __sk_common.skc_family);
+	BPF_CORE_READ_INTO(&ev->sport, sk, __sk_common.skc_num);
+	BPF_CORE_READ_INTO(&ev->dport, sk, __sk_common.skc_dport);
+	BPF_CORE_READ_INTO(&ev->netns, sk, __sk_common.skc_net.net, ns.inum);
+	ev->dport = bpf_ntohs(ev->dport);
+
+	if (ev->family == AF_INET) {
+		BPF_CORE_READ_INTO(&ev->saddr_v4, sk, __sk_common.skc_rcv_saddr);
+		BPF_CORE_READ_INTO(&ev->daddr_v4, sk, __sk_common.skc_daddr);
+	} else if (with_ipv6 && ev->family == AF_INET6) {
+		BPF_CORE_READ_INTO(&ev->saddr_v6, sk, __sk_common.skc_v6_rcv_saddr);
+		BPF_CORE_READ_INTO(&ev->daddr_v6, sk, __sk_common.skc_v6_daddr);
+	} else {
+		return -1;
+	}
+	return 0;
+}
+
+static __always_inline void fill_task(struct event *ev, bool with_pkg)
+{
+	struct task_struct *task;
+
+	ev->ts_ns = bpf_ktime_get_boot_ns();
+	ev->pid = bpf_get_current_pid_tgid() >> 32;
+	ev->uid = (u32)bpf_get_current_uid_gid();
+	ev->cgroup_id = bpf_get_current_cgroup_id();
+	bpf_get_current_comm(ev->comm, sizeof(ev->comm));
+
+	if (with_pkg) {
+		task = (struct task_struct *)bpf_get_current_task();
+		read_pkg_name(ev, task);
+	}
+}
+
+/* Slot tiep theo cua flight_ring tren CPU nay: dung thay heap, dien event
+ * thang vao do, flight_commit() moi tinh la da ghi. Bi loc giua chung thi lan
+ * sau ghi de len cung slot. */
+static __always_inline struct event *flight_slot(u32 mask)
+{
+	u32 zero = 0, idx;
+	u64 *head;
+
+	head = bpf_map_lookup_elem(&flight_head, &zero);
+	if (!head)
+		return NULL;
+	idx = *head & mask;
+	return bpf_map_lookup_elem(&flight_ring, &idx);
+}
+
+static __always_inline void flight_commit(void)
+{
+	u32 zero = 0;
+	u64 *head;
+
+	head = bpf_map_lookup_elem(&flight_head, &zero);
+	if (head)
+		*head += 1;
+}
+
+/*
+ * Slot tiep theo cua batch tren CPU nay, dien event thang vao do. Connect bi
+ * loc sau buoc nay de busy = 1 toi event sau: chi lam flush tu user-space
+ * cho them, event sau tren CPU do van tu flush theo tuoi.
+ */
+static __always_inline struct event *batch_slot(void)
+{
+	struct batch_stage *st;
+	u32 zero = 0, n;
+
+	st = bpf_map_lookup_elem(&batch_stage, &zero);
+	if (!st)
+		return NULL;
+	n = st->b.n;
+	if (n >= BATCH_MAX)
+		return NULL;
+	st->busy = 1;
+	return &st->b.ev[n];
+}
+
+static __always_inline void batch_flush(struct batch_stage *st, u64 *first_ts)
+{
+	u32 n = st->b.n;
+
+	if (n > BATCH_MAX)
+		n = BATCH_MAX;
+	if (n && bpf_ringbuf_output(&events, &st->b,
+				    offsetof(struct event_batch, ev) + n * sizeof(struct event), 0))
+		bpf_printk("[NetLog] ringbuf full, drop batch n=%u\n", n);
+	st->b.n = 0;
+	*first_ts = 0;
+}
+
+/* Tinh slot vua dien vao batch; gui khi du max event hoac batch da cu hon
+ * max_age_ns (khong co bpf_timer tren 5.10, xem bpf_prog_batch_flush). */
+static __always_inline void batch_commit(u32 max, u64 max_age_ns)
+{
+	struct batch_stage *st;
+	u32 zero = 0, n;
+	u64 *first, ts;
+
+	st = bpf_map_lookup_elem(&batch_stage, &zero);
+	first = bpf_map_lookup_elem(&batch_ts, &zero);
+	if (!st || !first)
+		return;
+	n = st->b.n;
+	if (n >= BATCH_MAX)
+		return;
+	ts = st->b.ev[n].ts_ns;
+	if (!n)
+		*first = ts;
+	st->b.n = ++n;
+	if (n >= max || ts - *first >= max_age_ns)
+		batch_flush(st, first);
+	st->busy = 0;
+}
+
+/* perfbuf la hang so .rodata: nhanh khong dung bi verifier bo, ke ca lenh
+ * tham chieu map khong duoc tao. */
+static __always_inline void submit_event(void *ctx, struct event *ev, bool perfbuf)
+{
+	struct event *rb_ev;
+
+	if (perfbuf) {
+		if (bpf_perf_event_output(ctx, &events_perf, BPF_F_CURRENT_CPU, ev, sizeof(*ev)))
+			bpf_printk("[NetLog] perf buffer full, drop pid=%d\n", ev->pid);
+		return;
+	}
+
+	rb_ev = bpf_ringbuf_reserve(&events, sizeof(*ev), 0);
+	if (!rb_ev) {
+		bpf_printk("[NetLog] ringbuf full, drop pid=%d\n", ev->pid);
+		return;
+	}
+
+	__builtin_memcpy(rb_ev, ev, sizeof(*ev));
+	bpf_ringbuf_submit(rb_ev, 0);
+}
+
+#endif /* __NETLOG_BPF_H */
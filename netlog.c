@@ -4,106 +4,3431 @@
  * Build (vi du, chinh lai duong dan cho NDK/toolchain cua ban):
  *   clang -g -O2 -target bpf -D__TARGET_ARCH_arm64 -I. -c netlog.bpf.c -o netlog.bpf.o
  *   bpftool gen skeleton netlog.bpf.o > netlog.skel.h
- *   $(CC) -g -O2 -I. netlog.c -lbpf -lelf -lz -o netlog
+ *   $(CC) -g -O2 -I. netlog.c netlog_sink.c netlog_pkg.c netlog_cgroup.c netlog_conn.c \
+ *          netlog_ring.c netlog_uring.c netlog_caps.c netlog_flight.c netlog_snap.c \
+ *          netlog_dns.c -lbpf -lelf -lz -lpthread -o netlog
  *
- * Luu y: BPF_MAP_TYPE_RINGBUF can kernel >= 5.8.
+ * Kiem tra --mem-budget khong cap phat heap sau khi khoi dong: build them ban
+ * netlog_alloc (cung nguon, them co duoi day) roi chay, ma thoat 1 la co cap phat:
+ *   $(CC) ... -DNETLOG_ALLOC_HOOK -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc \
+ *          ... -o netlog_alloc
+ *   timeout -s INT 30 ./netlog_alloc --mem-budget 8M [che do]; echo $?
+ *
+ * Luu y: can libbpf >= 1.3 (ring__*). Kernel < 5.8 khong co ring buffer thi
+ * tu dung perf buffer (xem netlog_caps.c).
  */
+#define _GNU_SOURCE         /* ppoll, accept4 */
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <signal.h>
 #include <string.h>
 #include <errno.h>
+#include <getopt.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
 #include <arpa/inet.h>
+#include <linux/perf_event.h>
 #include <linux/types.h>
 #include <bpf/libbpf.h>
+#include <bpf/bpf.h>
 #include "netlog.h"
+#include "netlog_sink.h"
+#include "netlog_pkg.h"
+#include "netlog_cgroup.h"
+#include "netlog_conn.h"
+#include "netlog_ring.h"
+#include "netlog_caps.h"
+#include "netlog_flight.h"
+#include "netlog_snap.h"
+#include "netlog_dns.h"
 #include "netlog.skel.h"
 
 #define AF_INET  2
 #define AF_INET6 10
 
+#define NSEC_PER_SEC  1000000000ULL
+#define NSEC_PER_MSEC 1000000ULL
+
+/* Chu ky tinh lai offset boot -> wall-clock (NTP co the chinh gio bat ky luc nao). */
+#define CLOCK_RESYNC_NS   (10 * NSEC_PER_SEC)
+#define REORDER_CAP_DEFAULT 4096
+#define TOP_N_DEFAULT       20
+#define BATCH_AGE_MS_DEFAULT 100
+
+static struct env {
+	unsigned int reorder_ms;   /* 0 = tat, in theo thu tu ring buffer */
+	unsigned int reorder_cap;
+	unsigned int conn_cap;     /* so dong cua bang ket noi (netlog_conn.c) */
+	unsigned int top_n;        /* != 0: che do --top, khong stream event */
+	bool scopes;               /* che do --scopes: dem theo cgroup/netns */
+	const char *pin_dir;       /* != NULL: pin/reuse object trong bpffs */
+	size_t mem_budget;         /* != 0: moi buffer chia tu budget, mlock */
+	unsigned int stats_sec;    /* != 0: --prog-stats, chu ky bao cao (giay) */
+	/* Cau hinh .rodata cua probe, xem netlog.bpf.c. */
+	bool no_pkg;
+	bool no_ipv6;
+	__u32 filter_uid;
+	__u16 filter_dport;
+	const char *filter_cgroup; /* path, doi sang id + level luc khoi dong */
+	const char *packages;      /* != NULL: uid -> pkg tu file packages.list */
+	const char *raw;           /* != NULL: --raw, ghi record nhi phan ra file/"-" */
+	bool perfbuf;              /* ep dung perf buffer du kernel co ring buffer */
+	__u32 flight;              /* != 0: --flight, so slot moi CPU (luy thua 2) */
+	const char *ctl;           /* != NULL: socket dieu khien cua --flight */
+	__u32 batch;               /* != 0: --batch, so event toi da moi record */
+	unsigned int batch_age_ms; /* batch cu hon thi bi flush */
+	bool no_snapshot;          /* khong dump socket TCP da co luc khoi dong */
+	unsigned int usage_sec;    /* != 0: --usage, chu ky bao cao (giay) */
+	bool flows;                /* them record luc ket noi dong (--flows) */
+	unsigned int retrans_sec;  /* != 0: --retrans, chu ky bao cao (giay) */
+	bool udp;                  /* them datagram UDP dau tien moi dich (--udp) */
+	bool inbound;              /* them ket noi TCP duoc accept (--inbound) */
+	bool dns;                  /* gan ten tu tra loi DNS cho daddr (--dns) */
+	unsigned int heavy_thresh; /* != 0: --heavy, --top dem bang count-min sketch */
+} env = {
+	.reorder_cap = REORDER_CAP_DEFAULT,
+	.conn_cap = CONN_TABLE_CAP,
+	.filter_uid = FILTER_UID_NONE,
+	.batch_age_ms = BATCH_AGE_MS_DEFAULT,
+};
+
+/* fd cua cac map user-space dung, lay tu skeleton (cold) hoac tu bpffs (warm).
+ * events la map cua transport dang dung (events hoac events_perf). */
+static struct {
+	int events;
+	int top_talkers;
+	int sample_ctl;
+	int cgroup_stats;
+	int netns_stats;
+	int flight_ring;
+	int flight_head;
+	int batch_ts;
+	int usage_stats;
+	int dest_stats;
+} map_fds = { -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 };
+
+static struct caps caps;
+
 static volatile sig_atomic_t exiting;
+static volatile sig_atomic_t dump_req;
 
 static void on_signal(int sig)
 {
 	exiting = 1;
 }
 
+static void on_dump(int sig)
+{
+	dump_req = 1;
+}
+
 static int libbpf_print_fn(enum libbpf_print_level level, const char *fmt, va_list args)
 {
 	return vfprintf(stderr, fmt, args);
 }
 
-static int handle_event(void *ctx, void *data, size_t data_sz)
+static __u64 clock_ns(clockid_t id)
+{
+	struct timespec ts;
+
+	clock_gettime(id, &ts);
+	return (__u64)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+/*
+ * ts_ns cua event la CLOCK_BOOTTIME (tinh ca thoi gian suspend), nen doi sang
+ * wall-clock chi can cong mot offset. Lay vai mau REALTIME/BOOTTIME/REALTIME
+ * va giu mau co cua so hep nhat de giam sai so do bi preempt giua 2 lan doc.
+ */
+static struct {
+	__s64 boot_to_real;
+	__u64 next_sync;
+} clk;
+
+static void clock_resync(void)
+{
+	__u64 best_win = ~0ULL;
+	int i;
+
+	for (i = 0; i < 3; i++) {
+		__u64 r0 = clock_ns(CLOCK_REALTIME);
+		__u64 b = clock_ns(CLOCK_BOOTTIME);
+		__u64 r1 = clock_ns(CLOCK_REALTIME);
+
+		if (r1 - r0 < best_win) {
+			best_win = r1 - r0;
+			clk.boot_to_real = (__s64)(r0 + (r1 - r0) / 2) - (__s64)b;
+		}
+	}
+	clk.next_sync = clock_ns(CLOCK_BOOTTIME) + CLOCK_RESYNC_NS;
+}
+
+static void format_addrs(const struct event *e, char *src, char *dst, size_t size)
+{
+	int af = e->family == AF_INET6 ? AF_INET6 : AF_INET;
+
+	if (e->family != AF_INET && e->family != AF_INET6)
+		return;
+	inet_ntop(af, e->family == AF_INET ? (const void *)&e->saddr_v4 : e->saddr_v6,
+		  src, size);
+	inet_ntop(af, e->family == AF_INET ? (const void *)&e->daddr_v4 : e->daddr_v6,
+		  dst, size);
+}
+
+static const char *tcp_state_name(__u8 state)
+{
+	static const char *const names[] = {
+		"?", "ESTABLISHED", "SYN_SENT", "SYN_RECV", "FIN_WAIT1", "FIN_WAIT2",
+		"TIME_WAIT", "CLOSE", "CLOSE_WAIT", "LAST_ACK", "LISTEN", "CLOSING",
+		"NEW_SYN_RECV",
+	};
+
+	return state < sizeof(names) / sizeof(names[0]) ? names[state] : "?";
+}
+
+/* Ten package: tu packages.list neu co, khong thi lay tu event (argv/comm). */
+static int event_pkg(const struct event *e, const char **name)
+{
+	size_t len = 0;
+
+	if (env.packages)
+		len = pkgdb_lookup(e->uid, name);
+	if (!len && e->kind == EVENT_CLOSE && e->close_pkg[0]) {
+		*name = e->close_pkg;
+		len = strnlen(*name, sizeof(e->close_pkg));
+	} else if (!len) {
+		*name = e->kind != EVENT_CLOSE && e->pkg_name[0] ? e->pkg_name : e->comm;
+		len = strnlen(*name, *name == e->comm ? sizeof(e->comm) : sizeof(e->pkg_name));
+	}
+	return len;
+}
+
+/* --dns: ten cua daddr con trong TTL luc co event, NULL neu khong biet. */
+static const char *event_host(const struct event *e)
+{
+	return env.dns ? dns_lookup(e->family, e->daddr_v6, e->ts_ns) : NULL;
+}
+
+/* Phan rieng theo kind, noi vao cuoi dong text. */
+static void format_kind_text(const struct event *e, char *buf, size_t size)
+{
+	const struct tcp_flow_stats *f = &e->flow;
+
+	buf[0] = '\0';
+	if (e->proto == IPPROTO_UDP)
+		snprintf(buf, size, " udp");
+	else if (e->kind == EVENT_SNAPSHOT)
+		snprintf(buf, size, " snap=%s", tcp_state_name(e->state));
+	else if (e->kind == EVENT_CLOSE)
+		snprintf(buf, size, " close dur=%llu.%03llus sent=%llu acked=%llu rcvd=%llu "
+			 "srtt=%uus retrans=%u",
+			 (unsigned long long)(f->duration_ns / NSEC_PER_SEC),
+			 (unsigned long long)(f->duration_ns % NSEC_PER_SEC / NSEC_PER_MSEC),
+			 (unsigned long long)f->bytes_sent, (unsigned long long)f->bytes_acked,
+			 (unsigned long long)f->bytes_received, f->srtt_us, f->total_retrans);
+}
+
+static int format_text(const struct event *e, char *buf, size_t size)
 {
-	const struct event *e = data;
 	char src[INET6_ADDRSTRLEN] = "?";
 	char dst[INET6_ADDRSTRLEN] = "?";
-	const char *proto = "?";
+	const char *proto = e->family == AF_INET ? "IPv4" :
+			    e->family == AF_INET6 ? "IPv6" : "?";
+	__u64 real = e->ts_ns + clk.boot_to_real;
+	time_t sec = real / NSEC_PER_SEC;
+	const char *pkg, *host = event_host(e);
+	int pkg_len = event_pkg(e, &pkg);
+	char tbuf[16], kind[160];
+	struct tm tm;
+
+	format_addrs(e, src, dst, sizeof(src));
+	format_kind_text(e, kind, sizeof(kind));
+	localtime_r(&sec, &tm);
+	strftime(tbuf, sizeof(tbuf), "%H:%M:%S", &tm);
+
+	return snprintf(buf, size,
+			"%s.%06llu %-16.16s pid=%-7u uid=%-7u pkg=%-24.*s %-4s %s:%u %s %s:%u w=%u "
+			"ns=%u cg=%llu flow=%llx%s%s%s\n",
+			tbuf, (unsigned long long)(real % NSEC_PER_SEC) / 1000,
+			e->comm, e->pid, e->uid, pkg_len, pkg, proto,
+			src, e->sport, e->dir == DIR_IN ? "<-" : "->", dst, e->dport, e->weight,
+			e->netns, (unsigned long long)e->cgroup_id,
+			(unsigned long long)e->flow_id, host ? " host=" : "", host ? host : "",
+			kind);
+}
 
-	if (e->family == AF_INET) {
-		proto = "IPv4";
-		inet_ntop(AF_INET, &e->saddr_v4, src, sizeof(src));
-		inet_ntop(AF_INET, &e->daddr_v4, dst, sizeof(dst));
-	} else if (e->family == AF_INET6) {
-		proto = "IPv6";
-		inet_ntop(AF_INET6, &e->saddr_v6, src, sizeof(src));
-		inet_ntop(AF_INET6, &e->daddr_v6, dst, sizeof(dst));
+/* comm/pkg_name lay tu user-space (argv) nen phai escape truoc khi dua vao JSON. */
+static size_t json_str(char *out, size_t size, const char *s, size_t max)
+{
+	size_t n = 0, i;
+
+	for (i = 0; i < max && s[i] && n + 7 < size; i++) {
+		unsigned char c = s[i];
+
+		if (c == '"' || c == '\\') {
+			out[n++] = '\\';
+			out[n++] = c;
+		} else if (c < 0x20) {
+			n += snprintf(out + n, size - n, "\\u%04x", c);
+		} else {
+			out[n++] = c;
+		}
 	}
+	out[n] = '\0';
+	return n;
+}
+
+static void format_kind_json(const struct event *e, char *buf, size_t size)
+{
+	const struct tcp_flow_stats *f = &e->flow;
+
+	if (e->kind == EVENT_SNAPSHOT)
+		snprintf(buf, size, "\"kind\":\"snapshot\",\"state\":\"%s\"",
+			 tcp_state_name(e->state));
+	else if (e->kind == EVENT_CLOSE)
+		snprintf(buf, size, "\"kind\":\"close\",\"duration_ns\":%llu,"
+			 "\"bytes_sent\":%llu,\"bytes_acked\":%llu,\"bytes_received\":%llu,"
+			 "\"srtt_us\":%u,\"retrans\":%u",
+			 (unsigned long long)f->duration_ns, (unsigned long long)f->bytes_sent,
+			 (unsigned long long)f->bytes_acked,
+			 (unsigned long long)f->bytes_received, f->srtt_us, f->total_retrans);
+	else
+		snprintf(buf, size, "\"kind\":\"connect\"");
+}
+
+static int format_json(const struct event *e, char *buf, size_t size)
+{
+	char src[INET6_ADDRSTRLEN] = "";
+	char dst[INET6_ADDRSTRLEN] = "";
+	char comm[TASK_COMM_LEN * 6 + 1];
+	char pkg[PKG_NAME_LEN * 6 + 1];
+	char kind[192], host[DNS_NAME_LEN + 16] = "";
+	const char *name, *h = event_host(e);
+	int name_len = event_pkg(e, &name);
+
+	format_addrs(e, src, dst, sizeof(src));
+	format_kind_json(e, kind, sizeof(kind));
+	/* Ten tu netlog_dns.c chi co chu, so, '-', '_', '.': khong can escape. */
+	if (h)
+		snprintf(host, sizeof(host), "\"host\":\"%s\",", h);
+	json_str(comm, sizeof(comm), e->comm, sizeof(e->comm));
+	json_str(pkg, sizeof(pkg), name, name_len);
+
+	return snprintf(buf, size,
+			"{\"ts\":%llu,\"pid\":%u,\"uid\":%u,\"comm\":\"%s\",\"pkg\":\"%s\","
+			"\"family\":%u,\"saddr\":\"%s\",\"sport\":%u,\"daddr\":\"%s\",\"dport\":%u,"
+			"\"weight\":%u,\"netns\":%u,\"cgroup\":%llu,\"flow\":%llu,"
+			"\"proto\":\"%s\",\"dir\":\"%s\",%s%s}\n",
+			(unsigned long long)(e->ts_ns + clk.boot_to_real),
+			e->pid, e->uid, comm, pkg, e->family, src, e->sport, dst, e->dport,
+			e->weight, e->netns, (unsigned long long)e->cgroup_id,
+			(unsigned long long)e->flow_id,
+			e->proto == IPPROTO_UDP ? "udp" : "tcp",
+			e->dir == DIR_IN ? "in" : "out", host, kind);
+}
+
+static void format_header(char *buf, size_t size)
+{
+	snprintf(buf, size, "%-15s %-16s %-7s %-7s %-24s %-4s %s\n",
+		 "TIME", "COMM", "PID", "UID", "PKG", "PROTO", "SRC:PORT -> DST:PORT");
+}
+
+static const sink_format_fn formatters[SINK_FMT_MAX] = {
+	[SINK_FMT_TEXT] = format_text,
+	[SINK_FMT_JSON] = format_json,
+};
 
-	printf("%-16s pid=%-7u uid=%-7u pkg=%-24s %-4s %s:%u -> %s:%u\n",
-	       e->comm, e->pid, e->uid, e->pkg_name, proto,
-	       src, e->sport, dst, e->dport);
+/* Do thoi gian khoi dong cold (load + verify + attach) so voi warm (--pin). */
+static struct {
+	__u64 t0;
+	int warm;
+	int first_event;
+} startup;
+
+/*
+ * Reorder buffer: ring buffer la MPSC nen thu tu doc ra la thu tu reserve
+ * tren cac CPU, khong phai thu tu ts_ns. Giu event trong min-heap theo ts_ns
+ * toi da reorder_ms roi moi in; heap day thi in event cu nhat ngay. Event den
+ * tre hon moc da in (vuot qua max delay) van duoc in, chi bi dem la "late".
+ */
+static struct {
+	struct event *heap;
+	unsigned int len;
+	__u64 max_delay_ns;
+	__u64 last_emit_ts;
+	__u64 late;
+} ro;
 
+static int reorder_init(unsigned int max_ms, unsigned int cap)
+{
+	ro.heap = calloc(cap, sizeof(*ro.heap));
+	if (!ro.heap)
+		return -ENOMEM;
+	ro.max_delay_ns = max_ms * NSEC_PER_MSEC;
 	return 0;
 }
 
-int main(void)
+static void heap_swap(struct event *a, struct event *b)
 {
-	struct netlog_bpf *skel;
-	struct ring_buffer *rb = NULL;
-	int err;
+	struct event tmp = *a;
 
-	libbpf_set_print(libbpf_print_fn);
-	signal(SIGINT, on_signal);
-	signal(SIGTERM, on_signal);
+	*a = *b;
+	*b = tmp;
+}
 
-	skel = netlog_bpf__open_and_load();
-	if (!skel) {
-		fprintf(stderr, "Loi: khong mo/load duoc BPF skeleton\n");
-		return 1;
+static void reorder_pop(void)
+{
+	unsigned int i = 0;
+
+	if (ro.heap[0].ts_ns < ro.last_emit_ts)
+		ro.late++;
+	else
+		ro.last_emit_ts = ro.heap[0].ts_ns;
+	sinks_emit(&ro.heap[0]);
+
+	ro.heap[0] = ro.heap[--ro.len];
+	for (;;) {
+		unsigned int l = 2 * i + 1, r = l + 1, m = i;
+
+		if (l < ro.len && ro.heap[l].ts_ns < ro.heap[m].ts_ns)
+			m = l;
+		if (r < ro.len && ro.heap[r].ts_ns < ro.heap[m].ts_ns)
+			m = r;
+		if (m == i)
+			break;
+		heap_swap(&ro.heap[i], &ro.heap[m]);
+		i = m;
 	}
+}
 
-	err = netlog_bpf__attach(skel);
-	if (err) {
-		fprintf(stderr, "Loi: khong attach duoc kprobe (%d)\n", err);
-		goto cleanup;
+static void reorder_push(const struct event *e)
+{
+	unsigned int i;
+
+	if (ro.len == env.reorder_cap)
+		reorder_pop();
+
+	i = ro.len++;
+	ro.heap[i] = *e;
+	while (i && ro.heap[(i - 1) / 2].ts_ns > ro.heap[i].ts_ns) {
+		heap_swap(&ro.heap[(i - 1) / 2], &ro.heap[i]);
+		i = (i - 1) / 2;
 	}
+}
 
-	rb = ring_buffer__new(bpf_map__fd(skel->maps.events), handle_event, NULL, NULL);
-	if (!rb) {
-		err = -1;
-		fprintf(stderr, "Loi: khong tao duoc ring buffer\n");
-		goto cleanup;
+/* In moi event da "chin" (cu hon now - max_delay); flush = in het. */
+static void reorder_drain(__u64 now, int flush)
+{
+	while (ro.len && (flush || ro.heap[0].ts_ns + ro.max_delay_ns <= now))
+		reorder_pop();
+}
+
+/*
+ * Sampling thich ung: sau moi vong poll do ty le day cua ring buffer va do tre
+ * cua event dau tien trong vong (now - ts_ns). Qua nguong thi gap doi rate,
+ * on dinh du lau thi giam mot nua, ghi vao map sample_ctl ma probe doc moi
+ * connect. Tang nhanh giam cham de khong dao dong quanh nguong.
+ */
+#define SAMPLE_RATE_MAX     1024
+#define SAMPLE_HIGH_OCC_PCT 50
+#define SAMPLE_LOW_OCC_PCT  10
+#define SAMPLE_HIGH_LAG_NS  (500 * NSEC_PER_MSEC)
+#define SAMPLE_LOW_LAG_NS   (50 * NSEC_PER_MSEC)
+#define SAMPLE_CALM_ROUNDS  10
+
+static struct {
+	__u32 rate;
+	unsigned int calm;
+	__u64 batch_first_ts;   /* ts_ns cua event dau tien trong vong poll */
+	__u64 lag_slack;        /* do tre co y (--batch-age), khong tinh la cham */
+	__u64 events, weighted;
+} smp = { .rate = 1 };
+
+/* avail/size: byte dang cho doc va kich thuoc vung data cua ring. */
+static void sampler_update(__u64 avail, __u64 size, __u64 now)
+{
+	struct sample_ctl ctl = {};
+	__u64 occ = 0, lag = 0;
+	__u32 rate = smp.rate, zero = 0;
+
+	if (size)
+		occ = avail * 100 / size;
+	if (smp.batch_first_ts && now > smp.batch_first_ts + smp.lag_slack)
+		lag = now - smp.batch_first_ts - smp.lag_slack;
+	smp.batch_first_ts = 0;
+
+	if (occ >= SAMPLE_HIGH_OCC_PCT || lag >= SAMPLE_HIGH_LAG_NS) {
+		smp.calm = 0;
+		if (rate < SAMPLE_RATE_MAX)
+			rate *= 2;
+	} else if (occ <= SAMPLE_LOW_OCC_PCT && lag <= SAMPLE_LOW_LAG_NS) {
+		if (rate > 1 && ++smp.calm >= SAMPLE_CALM_ROUNDS) {
+			smp.calm = 0;
+			rate /= 2;
+		}
+	} else {
+		smp.calm = 0;
+	}
+
+	if (rate == smp.rate)
+		return;
+	ctl.rate = rate;
+	if (bpf_map_update_elem(map_fds.sample_ctl, &zero, &ctl, BPF_ANY)) {
+		fprintf(stderr, "Loi: khong cap nhat duoc sample_ctl: %d\n", -errno);
+		return;
 	}
+	fprintf(stderr, "netlog: sampling 1/%u (ring %llu%%, tre %llu ms)\n", rate,
+		(unsigned long long)occ, (unsigned long long)(lag / NSEC_PER_MSEC));
+	smp.rate = rate;
+}
 
-	printf("%-16s %-7s %-7s %-24s %-4s %s\n",
-	       "COMM", "PID", "UID", "PKG", "PROTO", "SRC:PORT -> DST:PORT");
+static int handle_event(void *ctx, void *data, size_t data_sz)
+{
+	const struct event *e = data;
 
-	while (!exiting) {
-		err = ring_buffer__poll(rb, 200 /* ms */);
-		if (err == -EINTR) {
-			err = 0;
-			break;
+	if (!smp.batch_first_ts)
+		smp.batch_first_ts = e->ts_ns;
+	/* Uoc luong sampling chi tren connect: close cua --flows mang lai
+	 * weight cua connect, snapshot khong bi sampling. */
+	if (e->kind == EVENT_CONNECT) {
+		smp.events++;
+		smp.weighted += e->weight;
+	}
+
+	if (!startup.first_event) {
+		startup.first_event = 1;
+		fprintf(stderr, "netlog: %s start, event dau tien sau %.1f ms\n",
+			startup.warm ? "warm" : "cold",
+			(clock_ns(CLOCK_MONOTONIC) - startup.t0) / 1e6);
+	}
+
+	/* Theo thu tu den, khong cho reorder: record dong (handle_flow) tim
+	 * duoc dong connect ngay. */
+	if (e->kind == EVENT_CLOSE)
+		conn_del(e->flow_id);
+	else if (e->kind == EVENT_CONNECT && e->proto == IPPROTO_TCP)
+		conn_update(e);
+
+	if (!ro.heap) {
+		sinks_emit(e);
+		return 0;
+	}
+
+	reorder_push(e);
+	return 0;
+}
+
+/* flow_rec cua --flows: doi sang event de di cung duong reorder/sink. */
+static int handle_flow(void *ctx, const struct flow_rec *r)
+{
+	const struct conn *c = conn_get(r->flow_id);
+	struct event e;
+
+	memset(&e, 0, sizeof(e));
+	e.ts_ns = r->ts_ns;
+	e.cgroup_id = r->cgroup_id;
+	e.flow_id = r->flow_id;
+	e.pid = r->pid;
+	e.uid = r->uid;
+	e.netns = r->netns;
+	e.family = r->family;
+	e.sport = r->sport;
+	e.dport = r->dport;
+	e.weight = r->weight;
+	e.dir = r->dir;
+	e.kind = EVENT_CLOSE;
+	e.state = 7;    /* TCP_CLOSE */
+	e.proto = IPPROTO_TCP;
+	memcpy(e.saddr_v6, r->saddr_v6, sizeof(e.saddr_v6));
+	memcpy(e.daddr_v6, r->daddr_v6, sizeof(e.daddr_v6));
+	memcpy(e.comm, r->comm, sizeof(e.comm));
+	e.flow = r->st;
+	/* flow_rec khong co pkg: lay tu dong connect. */
+	if (c)
+		memcpy(e.close_pkg, c->pkg, sizeof(e.close_pkg));
+	return handle_event(ctx, &e, sizeof(e));
+}
+
+/* Record ring: 1 event, 1 flow_rec (--flows), 1 dns_rec (--dns, chi nap
+ * cache, khong ra output) hoac struct event_batch khi probe chay --batch. */
+static int handle_record(void *ctx, void *data, size_t data_sz)
+{
+	const struct event_batch *b = data;
+	__u32 i;
+	if (data_sz == sizeof(struct event))
+		return handle_event(ctx, data, data_sz);
+	if (data_sz == sizeof(struct flow_rec))
+		return handle_flow(ctx, data);
+	if (data_sz == sizeof(struct dns_rec)) {
+		dns_add(data);
+		return 0;
+	}
+	if (data_sz < offsetof(struct event_batch, ev) || b->n > BATCH_MAX ||
+	    data_sz < offsetof(struct event_batch, ev) + b->n * sizeof(struct event))
+		return 0;
+	for (i = 0; i < b->n; i++)
+		handle_event(ctx, (void *)&b->ev[i], sizeof(b->ev[i]));
+	return 0;
+}
+
+/*
+ * Flush batch cu: CPU dung im thi khong co event sau nao flush ho batch dang
+ * gom, user-space doc batch_ts (8 byte moi CPU) moi vong poll va chay
+ * bpf_prog_batch_flush tren dung CPU do. CPU khong co batch thi khong bi
+ * danh thuc.
+ */
+static struct {
+	int prog_fd;
+	int ncpu;
+	__u64 *ts;
+	__u64 kicks;
+	bool warned;
+} bat = { .prog_fd = -1 };
+
+/* bat.prog_fd da co tu skeleton (cold) hoac bpffs (warm). */
+static int batch_init(void)
+{
+	bat.ncpu = libbpf_num_possible_cpus();
+	if (bat.ncpu <= 0)
+		return bat.ncpu ? bat.ncpu : -EINVAL;
+	bat.ts = calloc(bat.ncpu, sizeof(*bat.ts));
+	return bat.ts ? 0 : -ENOMEM;
+}
+
+static void batch_kick(__u64 now, bool force)
+{
+	__u64 args[1] = { force };
+	LIBBPF_OPTS(bpf_test_run_opts, opts,
+		.ctx_in = args,
+		.ctx_size_in = sizeof(args),
+		.flags = BPF_F_TEST_RUN_ON_CPU,
+	);
+	__u64 age = env.batch_age_ms * NSEC_PER_MSEC;
+	__u32 zero = 0;
+	int cpu;
+
+	if (!bat.ts || bpf_map_lookup_elem(map_fds.batch_ts, &zero, bat.ts))
+		return;
+	for (cpu = 0; cpu < bat.ncpu; cpu++) {
+		if (!bat.ts[cpu] || (!force && now < bat.ts[cpu] + age))
+			continue;
+		opts.cpu = cpu;
+		if (!bpf_prog_test_run_opts(bat.prog_fd, &opts)) {
+			bat.kicks++;
+		} else if (errno != ENXIO && !bat.warned) {
+			/* ENXIO: CPU offline, batch o do cho CPU online lai. */
+			bat.warned = true;
+			fprintf(stderr, "netlog: khong flush duoc batch tren CPU %d (%d)\n",
+				cpu, -errno);
 		}
-		if (err < 0) {
-			fprintf(stderr, "Loi khi poll ring buffer: %d\n", err);
-			break;
+	}
+}
+
+static void batch_free(void)
+{
+	free(bat.ts);
+	bat.ts = NULL;
+}
+
+/*
+ * Transport event tu kernel: ring buffer (>= 5.8) hoac perf buffer moi CPU.
+ * Ca 2 dua cung struct event vao handle_event(). Perf buffer khong cho biet
+ * do day, sampler chi con dua vao do tre.
+ */
+static struct {
+	bool perfbuf;
+	size_t perf_pages;          /* trang moi CPU, luy thua 2 */
+	struct ring_buffer *rb;
+	struct perf_buffer *pb;
+	struct ring *ring;
+	__u64 lost;
+} xp = { .perf_pages = 64 };
+
+/* Perf buffer lam tron sample len boi 8 nen size co the lon hon record. */
+static void handle_perf_event(void *ctx, int cpu, void *data, __u32 size)
+{
+	if (size >= sizeof(struct event))
+		handle_event(ctx, data, size);
+	else if (size >= sizeof(struct flow_rec))
+		handle_flow(ctx, data);
+	else if (size >= sizeof(struct dns_rec))
+		dns_add(data);
+}
+
+static void handle_perf_lost(void *ctx, int cpu, __u64 cnt)
+{
+	xp.lost += cnt;
+}
+
+/* rb_fn/pb_fn: callback cho tung record, theo transport. */
+static int xport_open(int map_fd, ring_buffer_sample_fn rb_fn, perf_buffer_sample_fn pb_fn)
+{
+	if (xp.perfbuf) {
+		xp.pb = perf_buffer__new(map_fd, xp.perf_pages, pb_fn, handle_perf_lost,
+					 NULL, NULL);
+		return xp.pb ? 0 : -errno;
+	}
+	xp.rb = ring_buffer__new(map_fd, rb_fn, NULL, NULL);
+	if (!xp.rb)
+		return -errno;
+	xp.ring = ring_buffer__ring(xp.rb, 0);
+	return 0;
+}
+
+static int xport_poll(int timeout_ms)
+{
+	return xp.pb ? perf_buffer__poll(xp.pb, timeout_ms) :
+		       ring_buffer__poll(xp.rb, timeout_ms);
+}
+
+static void xport_free(void)
+{
+	if (xp.lost)
+		fprintf(stderr, "perf buffer: mat %llu event\n", (unsigned long long)xp.lost);
+	perf_buffer__free(xp.pb);
+	ring_buffer__free(xp.rb);
+}
+
+/*
+ * Doc ca hash map vao keys/vals (toi da cap phan tu). Kernel co batch ops thi
+ * moi syscall lay ca loat bucket; khong thi get_next_key + lookup tung key
+ * (key bi LRU don giua chung co the lam lan lai tu dau, dem trung vai key).
+ */
+static int map_dump(int fd, void *keys, __u32 key_size, void *vals, __u32 val_size,
+		    __u32 cap, __u32 *n)
+{
+	LIBBPF_OPTS(bpf_map_batch_opts, opts);
+	__u32 batch, cnt, total = 0;
+	void *prev = NULL;
+	int err;
+
+	if (caps.batch_ops) {
+		do {
+			cnt = cap - total;
+			err = bpf_map_lookup_batch(fd, total ? &batch : NULL, &batch,
+						   (char *)keys + total * key_size,
+						   (char *)vals + total * val_size, &cnt, &opts);
+			total += cnt;
+			/* ENOENT: het map; ENOSPC: bucket cuoi khong vua phan con lai. */
+			if (err && errno != ENOENT && errno != ENOSPC)
+				return -errno;
+		} while (!err && total < cap);
+		*n = total;
+		return 0;
+	}
+
+	while (total < cap) {
+		void *k = (char *)keys + total * key_size;
+
+		if (bpf_map_get_next_key(fd, prev, k)) {
+			if (errno == ENOENT)
+				break;
+			return -errno;
 		}
+		prev = k;
+		if (!bpf_map_lookup_elem(fd, k, (char *)vals + total * val_size))
+			total++;
 	}
+	*n = total;
+	return 0;
+}
 
-cleanup:
-	ring_buffer__free(rb);
+/*
+ * Che do --top: moi giay doc ca map top_talkers bang batch lookup, tru di so
+ * dem cua lan truoc (giu trong hash table user-space, 2 bang luan phien) de ra
+ * so connect trong chu ky, chon top N bang min-heap kich thuoc N roi ve lai
+ * man hinh.
+ */
+struct talker {
+	struct talker_key key;
+	__u64 count;    /* 0 = slot trong */
+	__u64 delta;
+};
+
+static struct {
+	int map_fd;
+	__u32 cap;
+	struct talker_key *keys;
+	__u64 *vals;
+	struct talker *prev, *cur;  /* open addressing, slots = 2 * cap */
+	__u32 slots;
+	struct talker **heap;
+	unsigned int heap_len;
+} top;
+
+/* FNV-1a tren ca key (key struct da zero padding). */
+static __u32 key_hash(const void *key, size_t len)
+{
+	const unsigned char *p = key;
+	__u32 h = 2166136261u;
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		h = (h ^ p[i]) * 16777619u;
+	return h;
+}
+
+static struct talker *talker_slot(struct talker *tbl, const struct talker_key *k)
+{
+	__u32 i = key_hash(k, sizeof(*k)) & (top.slots - 1);
+
+	while (tbl[i].count && memcmp(&tbl[i].key, k, sizeof(*k)))
+		i = (i + 1) & (top.slots - 1);
+	return &tbl[i];
+}
+
+static int top_init(int map_fd, __u32 cap)
+{
+	top.map_fd = map_fd;
+	top.cap = cap;
+	for (top.slots = 1; top.slots < 2 * cap; top.slots <<= 1)
+		;
+	top.keys = calloc(cap, sizeof(*top.keys));
+	top.vals = calloc(cap, sizeof(*top.vals));
+	top.prev = calloc(top.slots, sizeof(*top.prev));
+	top.cur = calloc(top.slots, sizeof(*top.cur));
+	top.heap = calloc(env.top_n, sizeof(*top.heap));
+	if (!top.keys || !top.vals || !top.prev || !top.cur || !top.heap)
+		return -ENOMEM;
+	return 0;
+}
+
+static void top_free(void)
+{
+	free(top.keys);
+	free(top.vals);
+	free(top.prev);
+	free(top.cur);
+	free(top.heap);
+}
+
+static void heap_sift_down(unsigned int i)
+{
+	for (;;) {
+		unsigned int l = 2 * i + 1, r = l + 1, m = i;
+		struct talker *tmp;
+
+		if (l < top.heap_len && top.heap[l]->delta < top.heap[m]->delta)
+			m = l;
+		if (r < top.heap_len && top.heap[r]->delta < top.heap[m]->delta)
+			m = r;
+		if (m == i)
+			return;
+		tmp = top.heap[i];
+		top.heap[i] = top.heap[m];
+		top.heap[m] = tmp;
+		i = m;
+	}
+}
+
+/* Giu N phan tu delta lon nhat: heap[0] la nho nhat trong top hien tai. */
+static void top_offer(struct talker *t)
+{
+	unsigned int i;
+
+	if (top.heap_len < env.top_n) {
+		i = top.heap_len++;
+		top.heap[i] = t;
+		while (i && top.heap[(i - 1) / 2]->delta > top.heap[i]->delta) {
+			struct talker *tmp = top.heap[(i - 1) / 2];
+
+			top.heap[(i - 1) / 2] = top.heap[i];
+			top.heap[i] = tmp;
+			i = (i - 1) / 2;
+		}
+		return;
+	}
+	if (t->delta <= top.heap[0]->delta)
+		return;
+	top.heap[0] = t;
+	heap_sift_down(0);
+}
+
+/* Heap sort tai cho: lan luot dua phan tu nho nhat ra cuoi -> thu tu giam dan,
+ * khong can qsort (co the malloc khi mang lon). */
+static void top_sort(void)
+{
+	unsigned int n = top.heap_len;
+
+	while (top.heap_len > 1) {
+		struct talker *tmp = top.heap[0];
+
+		top.heap[0] = top.heap[top.heap_len - 1];
+		top.heap[--top.heap_len] = tmp;
+		heap_sift_down(0);
+	}
+	top.heap_len = n;
+}
+
+/* Cot cua --top, heap da sap xep giam dan theo delta. */
+static void top_print(void)
+{
+	unsigned int i;
+
+	printf("%-32s %-3s %-39s %-5s %8s %10s\n", "PKG", "DIR", "PEER", "PORT", "CONN/s",
+	       "TOTAL");
+	for (i = 0; i < top.heap_len; i++) {
+		const struct talker *t = top.heap[i];
+		char dst[INET6_ADDRSTRLEN] = "?";
+
+		inet_ntop(t->key.family == AF_INET6 ? AF_INET6 : AF_INET,
+			  t->key.daddr, dst, sizeof(dst));
+		printf("%-32.32s %-3s %-39s %-5u %8llu %10llu\n", t->key.pkg_name,
+		       t->key.dir == DIR_IN ? "in" : "out", dst,
+		       t->key.dport, (unsigned long long)t->delta,
+		       (unsigned long long)t->count);
+	}
+	fflush(stdout);
+}
+
+static int top_read(__u32 *n)
+{
+	return map_dump(top.map_fd, top.keys, sizeof(*top.keys), top.vals,
+			sizeof(*top.vals), top.cap, n);
+}
+
+static int top_refresh(void)
+{
+	struct talker *tmp;
+	__u64 sum = 0;
+	__u32 i, n;
+	int err;
+
+	err = top_read(&n);
+	if (err)
+		return err;
+
+	memset(top.cur, 0, top.slots * sizeof(*top.cur));
+	top.heap_len = 0;
+	for (i = 0; i < n; i++) {
+		struct talker *old = talker_slot(top.prev, &top.keys[i]);
+		struct talker *t = talker_slot(top.cur, &top.keys[i]);
+
+		t->key = top.keys[i];
+		t->count = top.vals[i];
+		/* Key bi LRU day ra roi quay lai: counter bat dau lai tu 1. */
+		t->delta = old->count && old->count <= t->count ?
+			   t->count - old->count : t->count;
+		sum += t->delta;
+		if (t->delta)
+			top_offer(t);
+	}
+	tmp = top.prev;
+	top.prev = top.cur;
+	top.cur = tmp;
+
+	top_sort();
+
+	printf("\033[H\033[2J");
+	printf("netlog --top: %u flow, %llu connect/s\n\n", n, (unsigned long long)sum);
+	top_print();
+	return 0;
+}
+
+/*
+ * --heavy: --top khong dung top_talkers (1 phan tu moi dich) ma dung sketch
+ * co dinh trong kernel (map cms), chi flow co uoc luong >= nguong trong giay
+ * hien tai tren 1 CPU moi gui heavy_rec len ring. User-space cong chinh xac
+ * cac record do vao top.cur (toi da HEAVY_FLOWS_MAX flow), moi giay chon top
+ * N, tang epoch trong sample_ctl de probe bat dau chu ky moi.
+ *
+ * Sai so (CMS_WIDTH = w, CMS_DEPTH = d, N connect trong giay tren 1 CPU):
+ * uoc luong khong bao gio thap hon so that, cao hon qua e/w * N voi xac suat
+ * <= e^-d. Mac dinh w = 2048, d = 4: sai toi da ~0.13% N (xac suat 1.8%),
+ * 64 KiB moi CPU. Moi record mang uoc luong hien tai cua sketch, user-space
+ * giu max theo (flow, CPU) trong chu ky: so cua flow la tong uoc luong cuoi
+ * cua moi CPU, khong thap hon so that. netlog_bench -s do bang cac cap
+ * (w, d) khac.
+ */
+static struct {
+	unsigned int live;  /* flow trong top.cur */
+	unsigned int ncpu;
+	__u32 epoch;
+	__u32 *cpu_max;     /* [slot cua top.cur][cpu]: count lon nhat da nhan */
+	__u64 records;
+	__u64 dropped;      /* record cua flow moi khi top.cur day */
+	__u64 stale;        /* record cua chu ky truoc, den sau khi da chot */
+} hv;
+
+static size_t heavy_mem_usage(void)
+{
+	return 4 * HEAVY_FLOWS_MAX * sizeof(struct talker) +
+	       2 * HEAVY_FLOWS_MAX * libbpf_num_possible_cpus() * sizeof(__u32) +
+	       env.top_n * sizeof(struct talker *);
+}
+
+static int heavy_init(void)
+{
+	int ncpu = libbpf_num_possible_cpus();
+
+	if (ncpu <= 0)
+		return ncpu ? ncpu : -EINVAL;
+	hv.ncpu = ncpu;
+	for (top.slots = 1; top.slots < 2 * HEAVY_FLOWS_MAX; top.slots <<= 1)
+		;
+	top.prev = calloc(top.slots, sizeof(*top.prev));
+	top.cur = calloc(top.slots, sizeof(*top.cur));
+	top.heap = calloc(env.top_n, sizeof(*top.heap));
+	hv.cpu_max = calloc((size_t)top.slots * ncpu, sizeof(*hv.cpu_max));
+	return top.prev && top.cur && top.heap && hv.cpu_max ? 0 : -ENOMEM;
+}
+
+static void heavy_add(const struct heavy_rec *r)
+{
+	struct talker *t;
+	__u32 *max;
+
+	hv.records++;
+	if (r->epoch != (__u16)hv.epoch || r->cpu >= hv.ncpu) {
+		hv.stale++;
+		return;
+	}
+	t = talker_slot(top.cur, &r->key);
+	if (!t->count) {
+		if (hv.live >= HEAVY_FLOWS_MAX) {
+			hv.dropped++;
+			return;
+		}
+		hv.live++;
+		t->key = r->key;
+	}
+	max = &hv.cpu_max[(t - top.cur) * hv.ncpu + r->cpu];
+	if (r->count <= *max)
+		return;
+	t->count += r->count - *max;
+	t->delta += r->count - *max;
+	*max = r->count;
+}
+
+static int heavy_record(void *ctx, void *data, size_t data_sz)
+{
+	if (data_sz == sizeof(struct heavy_rec))
+		heavy_add(data);
+	return 0;
+}
+
+static void heavy_perf_event(void *ctx, int cpu, void *data, __u32 size)
+{
+	if (size >= sizeof(struct heavy_rec))
+		heavy_add(data);
+}
+
+/* Het 1 giay: TOTAL cong don khi flow van vuot nguong o giay truoc. */
+static void heavy_refresh(void)
+{
+	struct talker *tmp;
+	__u64 sum = 0;
+	__u32 i, zero = 0;
+
+	/* Lay het record cua chu ky nay truoc khi chot. */
+	xport_poll(0);
+	top.heap_len = 0;
+	for (i = 0; i < top.slots; i++) {
+		struct talker *t = &top.cur[i], *old;
+
+		if (!t->count)
+			continue;
+		old = talker_slot(top.prev, &t->key);
+		if (old->count)
+			t->count = old->count + t->delta;
+		sum += t->delta;
+		top_offer(t);
+	}
+	top_sort();
+
+	printf("\033[H\033[2J");
+	printf("netlog --top --heavy: %u flow >= %u connect/s/CPU, %llu connect/s",
+	       hv.live, env.heavy_thresh, (unsigned long long)sum);
+	if (hv.dropped)
+		printf(", bo %llu record (bang day)", (unsigned long long)hv.dropped);
+	printf("\n\n");
+	top_print();
+
+	tmp = top.prev;
+	top.prev = top.cur;
+	top.cur = tmp;
+	memset(top.cur, 0, top.slots * sizeof(*top.cur));
+	memset(hv.cpu_max, 0, (size_t)top.slots * hv.ncpu * sizeof(*hv.cpu_max));
+	hv.live = 0;
+	hv.epoch++;
+	bpf_map_update_elem(map_fds.sample_ctl, &zero,
+			    &(struct sample_ctl){ .rate = 1, .epoch = hv.epoch }, BPF_ANY);
+}
+
+/*
+ * Che do --scopes: giong --top nhung key la cgroup id va netns inode (moi
+ * container Android co cgroup va netns rieng). Map nho (SCOPE_STATS_MAX) nen
+ * bang user-space co dinh, cap phat 1 lan.
+ */
+#define SCOPE_SLOTS (2 * SCOPE_STATS_MAX)
+
+struct scope_cnt {
+	__u64 key;
+	__u64 count;    /* 0 = slot trong */
+	__u64 delta;
+};
+
+struct scope_tbl {
+	int map_fd;
+	__u32 key_size;
+	struct scope_cnt *prev, *cur;   /* open addressing, SCOPE_SLOTS slot */
+	struct scope_cnt **order;
+	unsigned int nr;
+	__u64 sum;
+};
+
+static struct {
+	struct scope_tbl cg, ns;
+	__u64 *keys;    /* key u32 cua netns_stats nam o nua dau */
+	__u64 *vals;
+} scp;
+
+static size_t scopes_mem_usage(void)
+{
+	return 2 * (2 * SCOPE_SLOTS * sizeof(struct scope_cnt) +
+		    SCOPE_STATS_MAX * sizeof(struct scope_cnt *)) +
+	       SCOPE_STATS_MAX * 2 * sizeof(__u64) + cgroup_mem_usage();
+}
+
+static int scope_tbl_init(struct scope_tbl *t, int map_fd, __u32 key_size)
+{
+	t->map_fd = map_fd;
+	t->key_size = key_size;
+	t->prev = calloc(SCOPE_SLOTS, sizeof(*t->prev));
+	t->cur = calloc(SCOPE_SLOTS, sizeof(*t->cur));
+	t->order = calloc(SCOPE_STATS_MAX, sizeof(*t->order));
+	return t->prev && t->cur && t->order ? 0 : -ENOMEM;
+}
+
+static void scope_tbl_free(struct scope_tbl *t)
+{
+	free(t->prev);
+	free(t->cur);
+	free(t->order);
+}
+
+static struct scope_cnt *scope_slot(struct scope_cnt *tbl, __u64 key)
+{
+	__u32 i = (__u32)((key * 0x9e3779b97f4a7c15ULL) >> 32) & (SCOPE_SLOTS - 1);
+
+	while (tbl[i].count && tbl[i].key != key)
+		i = (i + 1) & (SCOPE_SLOTS - 1);
+	return &tbl[i];
+}
+
+/* Doc ca map, tinh delta so voi lan truoc, xep giam dan theo delta. */
+static int scope_refresh(struct scope_tbl *t)
+{
+	__u32 total, i, j;
+	struct scope_cnt *tmp;
+	int err;
+
+	err = map_dump(t->map_fd, scp.keys, t->key_size, scp.vals, sizeof(*scp.vals),
+		       SCOPE_STATS_MAX, &total);
+	if (err)
+		return err;
+
+	memset(t->cur, 0, SCOPE_SLOTS * sizeof(*t->cur));
+	t->nr = 0;
+	t->sum = 0;
+	for (i = 0; i < total; i++) {
+		__u64 key = t->key_size == sizeof(__u64) ? scp.keys[i] :
+			    ((__u32 *)scp.keys)[i];
+		struct scope_cnt *old = scope_slot(t->prev, key);
+		struct scope_cnt *c = scope_slot(t->cur, key);
+
+		c->key = key;
+		c->count = scp.vals[i];
+		c->delta = old->count && old->count <= c->count ?
+			   c->count - old->count : c->count;
+		t->sum += c->delta;
+		/* Chen giu thu tu giam dan; it scope nen chen thang la du. */
+		for (j = t->nr++; j && t->order[j - 1]->delta < c->delta; j--)
+			t->order[j] = t->order[j - 1];
+		t->order[j] = c;
+	}
+	tmp = t->prev;
+	t->prev = t->cur;
+	t->cur = tmp;
+	return 0;
+}
+
+static int scopes_refresh(void)
+{
+	bool rescanned = false;
+	unsigned int i;
+	int err;
+
+	err = scope_refresh(&scp.cg);
+	if (!err)
+		err = scope_refresh(&scp.ns);
+	if (err)
+		return err;
+
+	printf("\033[H\033[2J");
+	printf("netlog --scopes: %llu connect/s\n\n", (unsigned long long)scp.cg.sum);
+	printf("%-20s %-40s %8s %10s\n", "CGROUP", "PATH", "CONN/s", "TOTAL");
+	for (i = 0; i < scp.cg.nr; i++) {
+		const struct scope_cnt *c = scp.cg.order[i];
+		const char *path = cgroup_path(c->key);
+
+		/* cgroup moi tao tu lan quet truoc: quet lai toi da 1 lan/chu ky. */
+		if (!path && !rescanned) {
+			rescanned = true;
+			cgroup_rescan();
+			path = cgroup_path(c->key);
+		}
+		printf("%-20llu %-40.40s %8llu %10llu\n", (unsigned long long)c->key,
+		       path ? path : "?", (unsigned long long)c->delta,
+		       (unsigned long long)c->count);
+	}
+	printf("\n%-20s %-40s %8s %10s\n", "NETNS", "", "CONN/s", "TOTAL");
+	for (i = 0; i < scp.ns.nr; i++) {
+		const struct scope_cnt *c = scp.ns.order[i];
+
+		printf("%-20llu %-40s %8llu %10llu\n", (unsigned long long)c->key, "",
+		       (unsigned long long)c->delta, (unsigned long long)c->count);
+	}
+	fflush(stdout);
+	return 0;
+}
+
+/*
+ * Che do --usage: byte/s theo (uid, protocol) tu usage_stats, dem trong
+ * cgroup_skb. Gia tri per-CPU nen cong cac CPU lai truoc khi tru lan truoc;
+ * con lai giong --scopes, bang co dinh cap phat 1 lan.
+ */
+#define USAGE_SLOTS (2 * USAGE_STATS_MAX)
+#define USAGE_ROWS  20
+
+struct usage_cnt {
+	__u64 key;              /* uid << 8 | proto */
+	bool used;
+	struct usage_val v;     /* tong moi CPU tu luc dem */
+	__u64 drx, dtx;         /* byte trong chu ky */
+};
+
+static struct {
+	int map_fd;
+	unsigned int ncpu;
+	struct usage_key *keys;
+	struct usage_val *vals;         /* USAGE_STATS_MAX * ncpu */
+	struct usage_cnt *prev, *cur;   /* open addressing, USAGE_SLOTS slot */
+	struct usage_cnt *order[USAGE_ROWS];
+	unsigned int nr;
+} usg;
+
+static size_t usage_mem_usage(void)
+{
+	return 2 * USAGE_SLOTS * sizeof(struct usage_cnt) +
+	       USAGE_STATS_MAX * (sizeof(struct usage_key) +
+				  libbpf_num_possible_cpus() * sizeof(struct usage_val));
+}
+
+static struct usage_cnt *usage_slot(struct usage_cnt *tbl, __u64 key)
+{
+	__u32 i = (__u32)((key * 0x9e3779b97f4a7c15ULL) >> 32) & (USAGE_SLOTS - 1);
+
+	while (tbl[i].used && tbl[i].key != key)
+		i = (i + 1) & (USAGE_SLOTS - 1);
+	return &tbl[i];
+}
+
+static __u64 counter_delta(__u64 old, __u64 cur)
+{
+	/* Key bi LRU day ra roi quay lai: counter bat dau lai tu 0. */
+	return old && old <= cur ? cur - old : cur;
+}
+
+static const char *proto_name(__u8 proto)
+{
+	static char buf[8];
+
+	switch (proto) {
+	case 0:              return "-";
+	case IPPROTO_TCP:    return "tcp";
+	case IPPROTO_UDP:    return "udp";
+	case IPPROTO_ICMP:   return "icmp";
+	case IPPROTO_ICMPV6: return "icmp6";
+	}
+	snprintf(buf, sizeof(buf), "%u", proto);
+	return buf;
+}
+
+static int usage_refresh(void)
+{
+	__u64 rx = 0, tx = 0;
+	struct usage_cnt *tmp;
+	__u32 total, i, j, cpu;
+	int err;
+
+	err = map_dump(usg.map_fd, usg.keys, sizeof(*usg.keys), usg.vals,
+		       usg.ncpu * sizeof(*usg.vals), USAGE_STATS_MAX, &total);
+	if (err)
+		return err;
+
+	memset(usg.cur, 0, USAGE_SLOTS * sizeof(*usg.cur));
+	usg.nr = 0;
+	for (i = 0; i < total; i++) {
+		const struct usage_val *pc = usg.vals + (size_t)i * usg.ncpu;
+		__u64 key = (__u64)usg.keys[i].uid << 8 | usg.keys[i].proto;
+		struct usage_cnt *old, *c;
+
+		if (env.filter_uid != FILTER_UID_NONE && usg.keys[i].uid != env.filter_uid)
+			continue;
+		old = usage_slot(usg.prev, key);
+		c = usage_slot(usg.cur, key);
+		c->key = key;
+		c->used = true;
+		for (cpu = 0; cpu < usg.ncpu; cpu++) {
+			c->v.rx_bytes += pc[cpu].rx_bytes;
+			c->v.tx_bytes += pc[cpu].tx_bytes;
+			c->v.rx_pkts += pc[cpu].rx_pkts;
+			c->v.tx_pkts += pc[cpu].tx_pkts;
+		}
+		c->drx = counter_delta(old->v.rx_bytes, c->v.rx_bytes);
+		c->dtx = counter_delta(old->v.tx_bytes, c->v.tx_bytes);
+		rx += c->drx;
+		tx += c->dtx;
+		if (!c->drx && !c->dtx)
+			continue;
+		/* Chi giu USAGE_ROWS dong lon nhat, chen giu thu tu giam dan. */
+		if (usg.nr == USAGE_ROWS) {
+			if (usg.order[USAGE_ROWS - 1]->drx + usg.order[USAGE_ROWS - 1]->dtx >=
+			    c->drx + c->dtx)
+				continue;
+			usg.nr--;
+		}
+		for (j = usg.nr++; j && usg.order[j - 1]->drx + usg.order[j - 1]->dtx <
+				       c->drx + c->dtx; j--)
+			usg.order[j] = usg.order[j - 1];
+		usg.order[j] = c;
+	}
+	tmp = usg.prev;
+	usg.prev = usg.cur;
+	usg.cur = tmp;
+
+	printf("\033[H\033[2J");
+	printf("netlog --usage: %u (uid, proto), rx %.1f KiB/s, tx %.1f KiB/s\n\n", total,
+	       rx / 1024.0 / env.usage_sec, tx / 1024.0 / env.usage_sec);
+	printf("%-10s %-32s %-5s %10s %10s %10s %10s\n", "UID", "PKG", "PROTO",
+	       "RX KiB/s", "TX KiB/s", "RX MiB", "TX MiB");
+	for (i = 0; i < usg.nr; i++) {
+		const struct usage_cnt *c = usg.order[i];
+		const char *pkg = "-";
+		size_t len = 1;
+
+		if (env.packages && !(len = pkgdb_lookup(c->key >> 8, &pkg))) {
+			pkg = "-";
+			len = 1;
+		}
+		printf("%-10llu %-32.*s %-5s %10.1f %10.1f %10.1f %10.1f\n",
+		       (unsigned long long)(c->key >> 8), (int)(len < 32 ? len : 32), pkg,
+		       proto_name(c->key & 0xff), c->drx / 1024.0 / env.usage_sec,
+		       c->dtx / 1024.0 / env.usage_sec, c->v.rx_bytes / 1048576.0,
+		       c->v.tx_bytes / 1048576.0);
+	}
+	fflush(stdout);
+	return 0;
+}
+
+/*
+ * Che do --retrans: so lan gui lai va RST moi giay theo (uid, daddr, dport)
+ * tu dest_stats (per-CPU, dem trong tracepoint TCP), xep theo tong trong chu
+ * ky. Cung kieu bang co dinh voi --usage.
+ */
+#define DEST_SLOTS (2 * DEST_STATS_MAX)
+#define DEST_ROWS  20
+
+struct dest_cnt {
+	struct dest_key key;
+	bool used;
+	struct dest_val v;      /* tong moi CPU tu luc dem */
+	struct dest_val d;      /* trong chu ky */
+	__u64 score;            /* d.retrans + d.rst_sent + d.rst_recv */
+};
+
+static struct {
+	int map_fd;
+	unsigned int ncpu;
+	struct dest_key *keys;
+	struct dest_val *vals;          /* DEST_STATS_MAX * ncpu */
+	struct dest_cnt *prev, *cur;    /* open addressing, DEST_SLOTS slot */
+	struct dest_cnt *order[DEST_ROWS];
+	unsigned int nr;
+} dsc;
+
+static size_t dest_mem_usage(void)
+{
+	return 2 * DEST_SLOTS * sizeof(struct dest_cnt) +
+	       DEST_STATS_MAX * (sizeof(struct dest_key) +
+				 libbpf_num_possible_cpus() * sizeof(struct dest_val));
+}
+
+static struct dest_cnt *dest_slot(struct dest_cnt *tbl, const struct dest_key *k)
+{
+	__u32 i = key_hash(k, sizeof(*k)) & (DEST_SLOTS - 1);
+
+	while (tbl[i].used && memcmp(&tbl[i].key, k, sizeof(*k)))
+		i = (i + 1) & (DEST_SLOTS - 1);
+	return &tbl[i];
+}
+
+static int dest_refresh(void)
+{
+	struct dest_val sum = {};
+	struct dest_cnt *tmp;
+	__u32 total, i, j, cpu;
+	int err;
+
+	err = map_dump(dsc.map_fd, dsc.keys, sizeof(*dsc.keys), dsc.vals,
+		       dsc.ncpu * sizeof(*dsc.vals), DEST_STATS_MAX, &total);
+	if (err)
+		return err;
+
+	memset(dsc.cur, 0, DEST_SLOTS * sizeof(*dsc.cur));
+	dsc.nr = 0;
+	for (i = 0; i < total; i++) {
+		const struct dest_val *pc = dsc.vals + (size_t)i * dsc.ncpu;
+		struct dest_cnt *old = dest_slot(dsc.prev, &dsc.keys[i]);
+		struct dest_cnt *c = dest_slot(dsc.cur, &dsc.keys[i]);
+
+		c->key = dsc.keys[i];
+		c->used = true;
+		for (cpu = 0; cpu < dsc.ncpu; cpu++) {
+			c->v.retrans += pc[cpu].retrans;
+			c->v.rst_sent += pc[cpu].rst_sent;
+			c->v.rst_recv += pc[cpu].rst_recv;
+		}
+		c->d.retrans = counter_delta(old->v.retrans, c->v.retrans);
+		c->d.rst_sent = counter_delta(old->v.rst_sent, c->v.rst_sent);
+		c->d.rst_recv = counter_delta(old->v.rst_recv, c->v.rst_recv);
+		c->score = c->d.retrans + c->d.rst_sent + c->d.rst_recv;
+		sum.retrans += c->d.retrans;
+		sum.rst_sent += c->d.rst_sent;
+		sum.rst_recv += c->d.rst_recv;
+		if (!c->score)
+			continue;
+		if (dsc.nr == DEST_ROWS) {
+			if (dsc.order[DEST_ROWS - 1]->score >= c->score)
+				continue;
+			dsc.nr--;
+		}
+		for (j = dsc.nr++; j && dsc.order[j - 1]->score < c->score; j--)
+			dsc.order[j] = dsc.order[j - 1];
+		dsc.order[j] = c;
+	}
+	tmp = dsc.prev;
+	dsc.prev = dsc.cur;
+	dsc.cur = tmp;
+
+	printf("\033[H\033[2J");
+	printf("netlog --retrans: %u dich, gui lai %.1f/s, rst gui %.1f/s, rst nhan %.1f/s\n\n",
+	       total, (double)sum.retrans / env.retrans_sec,
+	       (double)sum.rst_sent / env.retrans_sec, (double)sum.rst_recv / env.retrans_sec);
+	printf("%-10s %-32s %-39s %-5s %9s %9s %9s %10s\n", "UID", "PKG", "DADDR", "DPORT",
+	       "RETRANS/s", "RST_OUT/s", "RST_IN/s", "RETRANS");
+	for (i = 0; i < dsc.nr; i++) {
+		const struct dest_cnt *c = dsc.order[i];
+		char dst[INET6_ADDRSTRLEN] = "?";
+		const char *pkg = "-";
+		size_t len = 1;
+
+		if (env.packages && !(len = pkgdb_lookup(c->key.uid, &pkg))) {
+			pkg = "-";
+			len = 1;
+		}
+		inet_ntop(c->key.family == AF_INET6 ? AF_INET6 : AF_INET, c->key.daddr,
+			  dst, sizeof(dst));
+		printf("%-10u %-32.*s %-39s %-5u %9.1f %9.1f %9.1f %10llu\n", c->key.uid,
+		       (int)(len < 32 ? len : 32), pkg, dst, c->key.dport,
+		       (double)c->d.retrans / env.retrans_sec,
+		       (double)c->d.rst_sent / env.retrans_sec,
+		       (double)c->d.rst_recv / env.retrans_sec,
+		       (unsigned long long)c->v.retrans);
+	}
+	fflush(stdout);
+	return 0;
+}
+
+/*
+ * --prog-stats: bat thong ke run_cnt/run_time_ns cua kernel cho phien nay
+ * (BPF_ENABLE_STATS, giu fd la du; kernel cu thi ghi sysctl va tra lai gia tri
+ * cu khi thoat) roi dinh ky doc bpf_prog_info cua moi program netlog.
+ */
+#define PROG_STATS_MAX 8
+#define BPF_STATS_SYSCTL "/proc/sys/kernel/bpf_stats_enabled"
+
+static struct {
+	int nr;
+	int fds[PROG_STATS_MAX];
+	const char *names[PROG_STATS_MAX];
+	__u64 run_cnt[PROG_STATS_MAX];
+	__u64 run_time[PROG_STATS_MAX];
+	__u64 last_ns;
+	int stats_fd;
+	char sysctl_old;     /* 0 = khong dung sysctl */
+} pst = { .stats_fd = -1 };
+
+static int sysctl_stats_set(char v)
+{
+	int fd = open(BPF_STATS_SYSCTL, O_RDWR);
+	char old;
+
+	if (fd < 0)
+		return -errno;
+	if (read(fd, &old, 1) != 1 || lseek(fd, 0, SEEK_SET) ||
+	    write(fd, &v, 1) != 1) {
+		close(fd);
+		return -EIO;
+	}
+	close(fd);
+	if (!pst.sysctl_old)
+		pst.sysctl_old = old;
+	return 0;
+}
+
+static int prog_stats_add(int fd, const char *name)
+{
+	if (pst.nr == PROG_STATS_MAX || fd < 0)
+		return -EINVAL;
+	pst.fds[pst.nr] = fd;
+	pst.names[pst.nr] = name;
+	pst.nr++;
+	return 0;
+}
+
+static int prog_stats_start(void)
+{
+	pst.stats_fd = bpf_enable_stats(BPF_STATS_RUN_TIME);
+	if (pst.stats_fd < 0) {
+		int err = sysctl_stats_set('1');
+
+		if (err) {
+			fprintf(stderr, "Loi: khong bat duoc bpf stats (%d)\n", err);
+			return err;
+		}
+	}
+	pst.last_ns = clock_ns(CLOCK_MONOTONIC);
+	return 0;
+}
+
+static void prog_stats_tick(void)
+{
+	__u64 now = clock_ns(CLOCK_MONOTONIC), dt = now - pst.last_ns;
+	int i;
+
+	if (!env.stats_sec || dt < env.stats_sec * NSEC_PER_SEC)
+		return;
+	pst.last_ns = now;
+
+	for (i = 0; i < pst.nr; i++) {
+		struct bpf_prog_info info = {};
+		__u32 len = sizeof(info);
+		__u64 cnt, ns;
+
+		if (bpf_prog_get_info_by_fd(pst.fds[i], &info, &len))
+			continue;
+		cnt = info.run_cnt - pst.run_cnt[i];
+		ns = info.run_time_ns - pst.run_time[i];
+		pst.run_cnt[i] = info.run_cnt;
+		pst.run_time[i] = info.run_time_ns;
+
+		fprintf(stderr, "prog-stats %s: %.0f ns/lan, %.1f lan/s, %.4f%% mot CPU\n",
+			pst.names[i], cnt ? (double)ns / cnt : 0.0,
+			cnt * 1e9 / dt, ns * 100.0 / dt);
+	}
+}
+
+static void prog_stats_stop(void)
+{
+	if (pst.stats_fd >= 0)
+		close(pst.stats_fd);
+	if (pst.sysctl_old)
+		sysctl_stats_set(pst.sysctl_old);
+}
+
+/*
+ * --mem-budget: ring buffer, map dem, reorder buffer va pool message cua sink
+ * deu duoc chia tu mot budget, cap phat het truoc khi vao vong lap chinh roi
+ * mlockall. Kernel 5.10 tinh ca map BPF vao RLIMIT_MEMLOCK nen phan kernel
+ * cung nam trong budget.
+ *
+ * Build them -DNETLOG_ALLOC_HOOK -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc
+ * de dem so lan cap phat heap trong vong lap chinh: khac 0 thi netlog thoat
+ * voi ma 1 (xem dong build netlog_alloc o dau file).
+ */
+#ifdef NETLOG_ALLOC_HOOK
+static unsigned long alloc_calls;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+	__atomic_add_fetch(&alloc_calls, 1, __ATOMIC_RELAXED);
+	return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size)
+{
+	__atomic_add_fetch(&alloc_calls, 1, __ATOMIC_RELAXED);
+	return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+	__atomic_add_fetch(&alloc_calls, 1, __ATOMIC_RELAXED);
+	return __real_realloc(ptr, size);
+}
+
+#define alloc_count() __atomic_load_n(&alloc_calls, __ATOMIC_RELAXED)
+#else
+#define alloc_count() 0UL
+#endif
+
+/* Chi phi uoc luong cho moi phan tu hash map trong kernel (htab_elem + bucket). */
+#define HTAB_ELEM_OVERHEAD 64
+#define MEM_MIN_MSGS       16
+
+static struct {
+	size_t ring, maps, reorder, conn, top, sinks, pkg;
+	unsigned long steady_allocs;
+} mem;
+
+static char stdout_buf[16 * 1024];
+
+static int parse_size(const char *s, size_t *out)
+{
+	char *end;
+	unsigned long long v = strtoull(s, &end, 0);
+
+	switch (*end) {
+	case 'g': case 'G': v <<= 10; /* fallthrough */
+	case 'm': case 'M': v <<= 10; /* fallthrough */
+	case 'k': case 'K': v <<= 10; end++; break;
+	}
+	if (*end || !v)
+		return -EINVAL;
+	*out = v;
+	return 0;
+}
+
+static size_t pow2_floor(size_t v)
+{
+	size_t p = 1;
+
+	while (p <= v / 2)
+		p <<= 1;
+	return p;
+}
+
+/* Phan budget con lai cho sink: pool message co dinh. -EINVAL neu qua nho. */
+static int sinks_plan(size_t rest)
+{
+	unsigned int nr_msgs;
+
+	/* Chua co pool: sinks_mem_usage() = stack + hang doi cua thread ghi. */
+	if (rest < sinks_mem_usage())
+		return -EINVAL;
+	nr_msgs = (rest - sinks_mem_usage()) / sinks_msg_size();
+	if (nr_msgs < MEM_MIN_MSGS)
+		return -EINVAL;
+	return sinks_prealloc(nr_msgs) ? -ENOMEM : 0;
+}
+
+/* Chia budget, goi giua open() va load(). */
+static int mem_plan(struct netlog_bpf *skel)
+{
+	size_t page = sysconf(_SC_PAGESIZE), rest, top_elem, top_cap;
+	size_t talker_kern = sizeof(struct talker_key) + sizeof(__u64) + HTAB_ELEM_OVERHEAD;
+	size_t scope_kern = 2 * (2 * sizeof(__u64) + HTAB_ELEM_OVERHEAD);
+	size_t flow_kern, open_kern, conn_user;
+	int err;
+
+	/* Index packages.list (-k) da cap phat o pkgdb_open(): tru truoc, tra
+	 * lai cho env.mem_budget khi xong de bao cao tong. */
+	if (env.mem_budget <= pkgdb_mem_usage())
+		goto too_small;
+	mem.pkg = pkgdb_mem_usage();
+	env.mem_budget -= mem.pkg;
+
+	/* Map dem theo scope chi dung o --scopes, cac che do khac de 1 phan tu. */
+	if (!env.scopes) {
+		bpf_map__set_max_entries(skel->maps.cgroup_stats, 1);
+		bpf_map__set_max_entries(skel->maps.netns_stats, 1);
+	}
+	bpf_map__set_max_entries(skel->maps.flow_ids, 1);
+
+	if (env.scopes) {
+		mem.ring = page;
+		mem.maps = SCOPE_STATS_MAX * scope_kern;
+		mem.top = scopes_mem_usage();
+		if (env.mem_budget < mem.ring + mem.maps + mem.top)
+			goto too_small;
+	} else if (env.retrans_sec) {
+		mem.ring = page;
+		bpf_map__set_max_entries(skel->maps.top_talkers, 1);
+		mem.maps = DEST_STATS_MAX * (sizeof(struct dest_key) + HTAB_ELEM_OVERHEAD +
+					     libbpf_num_possible_cpus() *
+					     sizeof(struct dest_val)) +
+			   talker_kern + scope_kern;
+		mem.top = dest_mem_usage();
+		if (env.mem_budget < mem.ring + mem.maps + mem.top)
+			goto too_small;
+	} else if (env.usage_sec) {
+		mem.ring = page;
+		bpf_map__set_max_entries(skel->maps.top_talkers, 1);
+		mem.maps = USAGE_STATS_MAX * (sizeof(struct usage_key) + HTAB_ELEM_OVERHEAD +
+					      libbpf_num_possible_cpus() *
+					      sizeof(struct usage_val)) +
+			   talker_kern + scope_kern;
+		mem.top = usage_mem_usage();
+		if (env.mem_budget < mem.ring + mem.maps + mem.top)
+			goto too_small;
+	} else if (env.heavy_thresh) {
+		/* Ring chi chua heavy_rec cua flow lon; sketch co dinh. */
+		mem.ring = pow2_floor(env.mem_budget / 4);
+		if (mem.ring < page)
+			goto too_small;
+		bpf_map__set_max_entries(skel->maps.top_talkers, 1);
+		mem.maps = (size_t)CMS_DEPTH * CMS_WIDTH * libbpf_num_possible_cpus() *
+			   sizeof(struct cms_cell) + talker_kern + scope_kern;
+		mem.top = heavy_mem_usage();
+		if (env.mem_budget < mem.ring + mem.maps + mem.top)
+			goto too_small;
+	} else if (env.top_n) {
+		/* Khong stream event: ring nho nhat, phan con lai cho top_talkers
+		 * (trong kernel) va cac bang cua --top (user-space). */
+		mem.ring = page;
+		rest = env.mem_budget > mem.ring + scope_kern ?
+		       env.mem_budget - mem.ring - scope_kern : 0;
+		top_elem = talker_kern + sizeof(struct talker_key) + sizeof(__u64) +
+			   4 * sizeof(struct talker);
+		top_cap = rest / top_elem;
+		if (top_cap < 64)
+			goto too_small;
+		if (top_cap > TOP_TALKERS_MAX)
+			top_cap = TOP_TALKERS_MAX;
+		bpf_map__set_max_entries(skel->maps.top_talkers, top_cap);
+		mem.maps = top_cap * talker_kern + scope_kern;
+		mem.top = top_cap * (top_elem - talker_kern);
+	} else if (env.flight) {
+		/* Khong stream event: ring nho nhat, flight_ring (trong kernel) va
+		 * ban snapshot co dinh theo --flight N, phan con lai cho sink. */
+		mem.ring = page;
+		mem.maps = (size_t)env.flight * libbpf_num_possible_cpus() *
+			   ((sizeof(struct event) + 7) & ~(size_t)7) + talker_kern + scope_kern;
+		mem.top = flight_mem_usage(env.flight);
+		bpf_map__set_max_entries(skel->maps.top_talkers, 1);
+		if (env.mem_budget < mem.ring + mem.maps + mem.top)
+			goto too_small;
+		err = sinks_plan(env.mem_budget - mem.ring - mem.maps - mem.top);
+		if (err == -EINVAL)
+			goto too_small;
+		if (err)
+			return err;
+	} else {
+		mem.ring = pow2_floor(env.mem_budget / 2);
+		if (mem.ring < page)
+			goto too_small;
+		bpf_map__set_max_entries(skel->maps.top_talkers, 1);
+		mem.maps = talker_kern + scope_kern;
+		if (env.mem_budget < mem.ring + mem.maps)
+			goto too_small;
+		rest = env.mem_budget - mem.ring - mem.maps;
+
+		/* Bang ket noi cua --flows (va map sk -> flow id neu khong co
+		 * cookie, ket noi dang mo): toi da 1/4 phan con lai, cung so dong. */
+		flow_kern = skel->rodata->use_cookie ? 0 :
+			    2 * sizeof(__u64) + HTAB_ELEM_OVERHEAD;
+		open_kern = env.flows ? sizeof(__u64) + sizeof(struct flow_rec) +
+					HTAB_ELEM_OVERHEAD : 0;
+		conn_user = env.flows && !env.raw ? sizeof(struct conn) : 0;
+		if (conn_user + flow_kern + open_kern)
+			env.conn_cap = pow2_floor(rest / 4 /
+						  (conn_user + flow_kern + open_kern));
+		if (env.conn_cap > CONN_TABLE_CAP)
+			env.conn_cap = CONN_TABLE_CAP;
+		bpf_map__set_max_entries(skel->maps.flow_ids, flow_kern ? env.conn_cap : 1);
+		if (env.flows)
+			bpf_map__set_max_entries(skel->maps.open_flows, env.conn_cap);
+		mem.maps += env.conn_cap * (flow_kern + open_kern);
+		if (env.batch)
+			mem.maps += libbpf_num_possible_cpus() * (sizeof(struct event_batch) + 16);
+		/* --raw khong dung bang ket noi, reorder hay sink. */
+		mem.conn = (conn_user ? conn_mem_usage(env.conn_cap) : 0) +
+			   (env.dns && !env.raw ? dns_mem_usage(DNS_CACHE_CAP) : 0);
+		rest -= env.conn_cap * (flow_kern + open_kern) + mem.conn;
+		if (env.raw)
+			goto out;
+
+		if (env.reorder_ms) {
+			size_t cap = rest / 4 / sizeof(struct event);
+
+			if (cap < env.reorder_cap)
+				env.reorder_cap = cap ? cap : 1;
+			mem.reorder = env.reorder_cap * sizeof(struct event);
+			rest -= mem.reorder;
+		}
+
+		err = sinks_plan(rest);
+		if (err == -EINVAL)
+			goto too_small;
+		if (err)
+			return err;
+	}
+out:
+	if (xp.perfbuf) {
+		/* Perf buffer: moi CPU mot vung, so trang la luy thua 2. */
+		size_t ncpu = libbpf_num_possible_cpus();
+
+		xp.perf_pages = pow2_floor(mem.ring / ncpu / page);
+		mem.ring = xp.perf_pages * page * ncpu;
+	} else {
+		bpf_map__set_max_entries(skel->maps.events, mem.ring);
+	}
+	env.mem_budget += mem.pkg;
+	return 0;
+
+too_small:
+	env.mem_budget += mem.pkg;
+	fprintf(stderr, "Loi: --mem-budget %zu qua nho\n", env.mem_budget);
+	return -EINVAL;
+}
+
+static void proc_status_kb(const char *key, unsigned long *kb)
+{
+	size_t n = strlen(key);
+	char line[128];
+	FILE *f;
+
+	*kb = 0;
+	f = fopen("/proc/self/status", "r");
+	if (!f)
+		return;
+	while (fgets(line, sizeof(line), f))
+		if (!strncmp(line, key, n) && line[n] == ':')
+			*kb = strtoul(line + n + 1, NULL, 10);
+	fclose(f);
+}
+
+/* Goi ngay truoc vong lap chinh: moi buffer da cap phat xong. */
+static void mem_lock_and_report(void)
+{
+	unsigned long rss, lck;
+
+	/* Nhung thu lazy-init co the malloc lan dau dung: lam truoc khi khoa. */
+	tzset();
+	setvbuf(stdout, stdout_buf, _IOFBF, sizeof(stdout_buf));
+
+	if (mlockall(MCL_CURRENT | MCL_FUTURE))
+		fprintf(stderr, "netlog: mlockall loi %d (can CAP_IPC_LOCK hoac "
+			"RLIMIT_MEMLOCK lon hon)\n", -errno);
+
+	mem.sinks = sinks_mem_usage();
+	proc_status_kb("VmRSS", &rss);
+	proc_status_kb("VmLck", &lck);
+	fprintf(stderr,
+		"mem-budget %zu KiB\n"
+		"  kernel: ring %zu KiB, map (uoc luong) %zu KiB\n"
+		"  user:   reorder %zu KiB, conn %zu KiB, sink %zu KiB, top/scopes/flight %zu KiB, "
+		"pkg %zu KiB\n"
+		"  VmRSS %lu KiB, VmLck %lu KiB\n",
+		env.mem_budget >> 10, mem.ring >> 10, mem.maps >> 10,
+		mem.reorder >> 10, mem.conn >> 10, mem.sinks >> 10, mem.top >> 10,
+		mem.pkg >> 10, rss, lck);
+
+	mem.steady_allocs = alloc_count();
+}
+
+/* Tra ve err, hoac -ENOMEM neu vong lap chinh co cap phat heap. */
+static int mem_check_steady(int err)
+{
+#ifdef NETLOG_ALLOC_HOOK
+	unsigned long n = alloc_count() - mem.steady_allocs;
+
+	fprintf(stderr, "mem-budget: %lu lan cap phat heap trong vong lap chinh\n", n);
+	if (n && !err) {
+		fprintf(stderr, "Loi: --mem-budget nhung vong lap chinh van cap phat heap\n");
+		err = -ENOMEM;
+	}
+#endif
+	return err;
+}
+
+static int run_top(int map_fd, __u32 max_entries)
+{
+	int err;
+
+	err = top_init(map_fd, max_entries);
+	if (err) {
+		fprintf(stderr, "Loi: khong cap phat duoc bo nho cho --top\n");
+		goto out;
+	}
+	if (env.mem_budget)
+		mem_lock_and_report();
+
+	while (!exiting) {
+		sleep(1);
+		err = top_refresh();
+		if (err) {
+			fprintf(stderr, "Loi: batch lookup top_talkers: %d\n", err);
+			break;
+		}
+		prog_stats_tick();
+	}
+	if (env.mem_budget)
+		err = mem_check_steady(err);
+out:
+	top_free();
+	return err;
+}
+
+static int run_heavy(int events_fd)
+{
+	__u64 now, next;
+	int err;
+
+	err = heavy_init();
+	if (!err)
+		err = xport_open(events_fd, heavy_record, heavy_perf_event);
+	if (err) {
+		fprintf(stderr, "Loi: khong khoi tao duoc --heavy (%d)\n", err);
+		goto out;
+	}
+	if (env.mem_budget)
+		mem_lock_and_report();
+
+	next = clock_ns(CLOCK_BOOTTIME) + NSEC_PER_SEC;
+	while (!exiting) {
+		err = xport_poll(200 /* ms */);
+		if (err == -EINTR) {
+			err = 0;
+			break;
+		}
+		if (err < 0) {
+			fprintf(stderr, "Loi khi poll ring buffer: %d\n", err);
+			break;
+		}
+		err = 0;
+
+		now = clock_ns(CLOCK_BOOTTIME);
+		if (now >= next) {
+			heavy_refresh();
+			next = now + NSEC_PER_SEC;
+		}
+		prog_stats_tick();
+	}
+	if (env.mem_budget)
+		err = mem_check_steady(err);
+	if (hv.dropped || hv.stale)
+		fprintf(stderr, "heavy: nhan %llu record, bo %llu do bang day, %llu tre chu ky\n",
+			(unsigned long long)hv.records, (unsigned long long)hv.dropped,
+			(unsigned long long)hv.stale);
+out:
+	xport_free();
+	top_free();
+	free(hv.cpu_max);
+	return err;
+}
+
+static int run_scopes(void)
+{
+	int err;
+
+	err = scope_tbl_init(&scp.cg, map_fds.cgroup_stats, sizeof(__u64));
+	if (!err)
+		err = scope_tbl_init(&scp.ns, map_fds.netns_stats, sizeof(__u32));
+	scp.keys = calloc(SCOPE_STATS_MAX, sizeof(*scp.keys));
+	scp.vals = calloc(SCOPE_STATS_MAX, sizeof(*scp.vals));
+	if (err || !scp.keys || !scp.vals) {
+		fprintf(stderr, "Loi: khong cap phat duoc bo nho cho --scopes\n");
+		err = -ENOMEM;
+		goto out;
+	}
+	/* Quet cay cgroup truoc khi khoa bo nho, cac lan sau chi khi gap id moi. */
+	cgroup_rescan();
+	if (env.mem_budget)
+		mem_lock_and_report();
+
+	while (!exiting) {
+		sleep(1);
+		err = scopes_refresh();
+		if (err) {
+			fprintf(stderr, "Loi: batch lookup cgroup_stats/netns_stats: %d\n", err);
+			break;
+		}
+		prog_stats_tick();
+	}
+	if (env.mem_budget)
+		err = mem_check_steady(err);
+out:
+	scope_tbl_free(&scp.cg);
+	scope_tbl_free(&scp.ns);
+	free(scp.keys);
+	free(scp.vals);
+	cgroup_free();
+	return err;
+}
+
+static int run_usage(void)
+{
+	int err = 0;
+
+	usg.map_fd = map_fds.usage_stats;
+	usg.ncpu = libbpf_num_possible_cpus();
+	usg.keys = calloc(USAGE_STATS_MAX, sizeof(*usg.keys));
+	usg.vals = calloc((size_t)USAGE_STATS_MAX * usg.ncpu, sizeof(*usg.vals));
+	usg.prev = calloc(USAGE_SLOTS, sizeof(*usg.prev));
+	usg.cur = calloc(USAGE_SLOTS, sizeof(*usg.cur));
+	if (!usg.keys || !usg.vals || !usg.prev || !usg.cur) {
+		fprintf(stderr, "Loi: khong cap phat duoc bo nho cho --usage\n");
+		err = -ENOMEM;
+		goto out;
+	}
+	if (env.mem_budget)
+		mem_lock_and_report();
+
+	while (!exiting) {
+		sleep(env.usage_sec);
+		err = usage_refresh();
+		if (err) {
+			fprintf(stderr, "Loi: doc usage_stats: %d\n", err);
+			break;
+		}
+		if (env.packages)
+			pkgdb_check();
+		prog_stats_tick();
+	}
+	if (env.mem_budget)
+		err = mem_check_steady(err);
+out:
+	free(usg.keys);
+	free(usg.vals);
+	free(usg.prev);
+	free(usg.cur);
+	return err;
+}
+
+static int run_retrans(void)
+{
+	int err = 0;
+
+	dsc.map_fd = map_fds.dest_stats;
+	dsc.ncpu = libbpf_num_possible_cpus();
+	dsc.keys = calloc(DEST_STATS_MAX, sizeof(*dsc.keys));
+	dsc.vals = calloc((size_t)DEST_STATS_MAX * dsc.ncpu, sizeof(*dsc.vals));
+	dsc.prev = calloc(DEST_SLOTS, sizeof(*dsc.prev));
+	dsc.cur = calloc(DEST_SLOTS, sizeof(*dsc.cur));
+	if (!dsc.keys || !dsc.vals || !dsc.prev || !dsc.cur) {
+		fprintf(stderr, "Loi: khong cap phat duoc bo nho cho --retrans\n");
+		err = -ENOMEM;
+		goto out;
+	}
+	if (env.mem_budget)
+		mem_lock_and_report();
+
+	while (!exiting) {
+		sleep(env.retrans_sec);
+		err = dest_refresh();
+		if (err) {
+			fprintf(stderr, "Loi: doc dest_stats: %d\n", err);
+			break;
+		}
+		if (env.packages)
+			pkgdb_check();
+		prog_stats_tick();
+	}
+	if (env.mem_budget)
+		err = mem_check_steady(err);
+out:
+	free(dsc.keys);
+	free(dsc.vals);
+	free(dsc.prev);
+	free(dsc.cur);
+	return err;
+}
+
+static int skb_attach(struct bpf_program *prog, struct bpf_link **link, int cg_fd)
+{
+	*link = bpf_program__attach_cgroup(prog, cg_fd);
+	return *link ? 0 : -errno;
+}
+
+/*
+ * Attach program cgroup_skb (--usage, --udp, --dns) vao goc cgroup2 (moi goi cua
+ * may) hoac vao --cgroup. Dung BPF link (multi-attach) nen khong thay program
+ * cua netd dang gan o cung cgroup; link nam trong skeleton, destroy() go ra.
+ */
+static int cgroup_skb_attach(struct netlog_bpf *skel)
+{
+	int cg_fd, err = 0;
+
+	cg_fd = cgroup_open(env.filter_cgroup);
+	if (cg_fd < 0)
+		return cg_fd;
+	if (env.usage_sec) {
+		err = skb_attach(skel->progs.bpf_prog_usage_ingress,
+				 &skel->links.bpf_prog_usage_ingress, cg_fd);
+		if (!err)
+			err = skb_attach(skel->progs.bpf_prog_usage_egress,
+					 &skel->links.bpf_prog_usage_egress, cg_fd);
+	}
+	if (!err && env.udp)
+		err = skb_attach(skel->progs.bpf_prog_udp_egress,
+				 &skel->links.bpf_prog_udp_egress, cg_fd);
+	if (!err && env.dns)
+		err = skb_attach(skel->progs.bpf_prog_dns_ingress,
+				 &skel->links.bpf_prog_dns_ingress, cg_fd);
+	close(cg_fd);
+	return err;
+}
+
+/*
+ * Socket TCP da mo truoc khi probe attach (ket noi dai, netlog vua khoi dong
+ * lai): dua vao bang ket noi va ra output nhu event, kind = snapshot. Qua
+ * bpf_iter_tcp neu kernel co, khong thi /proc/net/tcp{,6}.
+ */
+static int snap_prog_fd = -1;
+
+static int snap_emit(const struct event *e, void *ctx)
+{
+	/* Iterator da loc trong kernel, /proc thi chua. */
+	if (env.filter_uid != FILTER_UID_NONE && e->uid != env.filter_uid)
+		return 0;
+	if (env.filter_dport && e->dport != env.filter_dport)
+		return 0;
+	if (ro.heap)
+		reorder_push(e);
+	else
+		sinks_emit(e);
+	return 0;
+}
+
+static void snapshot_existing(void)
+{
+	__u64 t0 = clock_ns(CLOCK_MONOTONIC);
+	const char *how = "bpf_iter";
+	int n = -ENOTSUP;
+
+	/* Socket khong mang cgroup cua task da tao no theo cach doc duoc o day. */
+	if (env.filter_cgroup) {
+		fprintf(stderr, "netlog: co --cgroup, bo qua snapshot socket TCP\n");
+		return;
+	}
+	if (snap_prog_fd >= 0)
+		n = snap_iter(snap_prog_fd, snap_emit, NULL);
+	if (n < 0) {
+		how = "/proc/net/tcp";
+		n = snap_proc(!env.no_ipv6, snap_emit, NULL);
+	}
+	if (n < 0) {
+		fprintf(stderr, "netlog: khong snapshot duoc socket TCP (%d)\n", n);
+		return;
+	}
+	fprintf(stderr, "netlog: snapshot %d socket TCP qua %s trong %.1f ms\n", n, how,
+		(clock_ns(CLOCK_MONOTONIC) - t0) / 1e6);
+}
+
+static int run_events(int events_fd)
+{
+	char header[128];
+	unsigned int live;
+	__u64 evicted;
+	int err = 0;
+
+	err = xport_open(events_fd, handle_record, handle_perf_event);
+	if (err) {
+		fprintf(stderr, "Loi: khong tao duoc %s (%d)\n",
+			xp.perfbuf ? "perf buffer" : "ring buffer", err);
+		return err;
+	}
+
+	format_header(header, sizeof(header));
+	err = sinks_start(formatters, header);
+	if (err) {
+		xport_free();
+		return err;
+	}
+	if (env.flows && conn_init(env.conn_cap))
+		fprintf(stderr, "netlog: khong cap phat duoc bang ket noi, bo qua\n");
+	if (env.dns && dns_init(DNS_CACHE_CAP))
+		fprintf(stderr, "netlog: khong cap phat duoc cache DNS, bo qua --dns\n");
+	if (env.batch) {
+		err = batch_init();
+		if (err) {
+			fprintf(stderr, "Loi: khong cap phat duoc bo nho cho --batch\n");
+			goto out;
+		}
+		smp.lag_slack = env.batch_age_ms * NSEC_PER_MSEC;
+	}
+	/* Sau khi probe attach: connect xay ra trong luc snapshot co the ra 2
+	 * lan (connect + snapshot) nhung khong bi lot. */
+	if (!env.no_snapshot)
+		snapshot_existing();
+	/* Warm start: map pin co the con rate cua lan chay truoc. */
+	bpf_map_update_elem(map_fds.sample_ctl, &(__u32){ 0 },
+			    &(struct sample_ctl){ .rate = 1 }, BPF_ANY);
+	if (env.mem_budget)
+		mem_lock_and_report();
+
+	while (!exiting) {
+		__u64 now;
+		/* Co reorder thi poll ngan hon de khong giu event qua max delay. */
+		int timeout = ro.heap && env.reorder_ms < 200 ? (int)env.reorder_ms : 200;
+
+		/* Batch phai duoc flush kip --batch-age. */
+		if (env.batch && (int)env.batch_age_ms < timeout)
+			timeout = env.batch_age_ms;
+
+		err = xport_poll(timeout /* ms */);
+		if (err == -EINTR) {
+			err = 0;
+			break;
+		}
+		if (err < 0) {
+			fprintf(stderr, "Loi khi poll ring buffer: %d\n", err);
+			break;
+		}
+		err = 0;
+
+		now = clock_ns(CLOCK_BOOTTIME);
+		if (now >= clk.next_sync)
+			clock_resync();
+		if (env.batch)
+			batch_kick(now, false);
+		if (ro.heap)
+			reorder_drain(now, 0);
+		sampler_update(xp.ring ? ring__avail_data_size(xp.ring) : 0,
+			       xp.ring ? ring__size(xp.ring) : 0, now);
+		prog_stats_tick();
+		if (env.packages)
+			pkgdb_check();
+	}
+	if (env.mem_budget)
+		err = mem_check_steady(err);
+
+	/* Event con nam trong batch cua cac CPU. */
+	if (env.batch) {
+		batch_kick(0, true);
+		ring_buffer__consume(xp.rb);
+		fprintf(stderr, "batch: %llu lan flush tu user-space\n",
+			(unsigned long long)bat.kicks);
+	}
+	if (ro.heap)
+		reorder_drain(0, 1);
+	if (smp.events != smp.weighted)
+		fprintf(stderr, "sampling: nhan %llu event, uoc luong %llu connect\n",
+			(unsigned long long)smp.events, (unsigned long long)smp.weighted);
+	conn_stats(&live, &evicted);
+	if (evicted)
+		fprintf(stderr, "conn: %u ket noi trong bang, %llu bi bo do bang day\n",
+			live, (unsigned long long)evicted);
+	if (env.dns) {
+		__u64 added, dropped;
+
+		dns_stats(&added, &dropped);
+		fprintf(stderr, "dns: nhan %llu ban ghi A/AAAA, %llu con han bi bo do cache day\n",
+			(unsigned long long)added, (unsigned long long)dropped);
+	}
+out:
+	batch_free();
+	conn_free();
+	dns_free();
+	sinks_stop();
+	xport_free();
+	return err;
+}
+
+/*
+ * --flight: probe chi ghi vao flight_ring trong kernel, user-space ngu trong
+ * ppoll() toi khi co SIGUSR1 (dump ra cac output -o) hoac lenh "dump" tren
+ * socket --ctl (dump ve chinh ket noi do, dang text). Luc binh thuong khong
+ * co lan thuc day nao (tru --prog-stats).
+ */
+#define CTL_IO_TIMEOUT_SEC 2
+
+/* Socket unix stream, "@ten" = abstract namespace (khong can file). */
+static int ctl_listen(const char *path)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	size_t len = strlen(path);
+	int fd;
+
+	if (len >= sizeof(addr.sun_path))
+		return -ENAMETOOLONG;
+	memcpy(addr.sun_path, path, len);
+	if (path[0] == '@')
+		addr.sun_path[0] = '\0';
+	else
+		unlink(path);
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -errno;
+	if (bind(fd, (struct sockaddr *)&addr, offsetof(struct sockaddr_un, sun_path) + len) ||
+	    listen(fd, 4)) {
+		int err = -errno;
+
+		close(fd);
+		return err;
+	}
+	return fd;
+}
+
+static int write_all(int fd, const char *buf, size_t len)
+{
+	ssize_t n;
+
+	while (len) {
+		n = write(fd, buf, len);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		buf += n;
+		len -= n;
+	}
+	return 0;
+}
+
+/* out_fd < 0: qua sink (SIGUSR1), khong thi ghi text thang ra out_fd. */
+static int flight_dump(struct flight *f, int out_fd)
+{
+	const struct event **evs;
+	char buf[1024];
+	int n, i, len, err = 0;
+
+	if (env.packages)
+		pkgdb_check();
+	if (clock_ns(CLOCK_BOOTTIME) >= clk.next_sync)
+		clock_resync();
+
+	n = flight_snapshot(f, &evs);
+	if (n < 0) {
+		fprintf(stderr, "Loi: doc flight_ring: %d\n", n);
+		return n;
+	}
+	if (out_fd >= 0) {
+		format_header(buf, sizeof(buf));
+		err = write_all(out_fd, buf, strlen(buf));
+	}
+	for (i = 0; i < n && !err; i++) {
+		if (out_fd < 0) {
+			sinks_emit(evs[i]);
+			continue;
+		}
+		len = format_text(evs[i], buf, sizeof(buf));
+		err = write_all(out_fd, buf, len < (int)sizeof(buf) ? len : (int)sizeof(buf) - 1);
+	}
+	fprintf(stderr, "netlog: flight dump %d event%s\n", n, out_fd < 0 ? "" : " (ctl)");
+	return err;
+}
+
+/* Mot ket noi mot lenh; client cham qua CTL_IO_TIMEOUT_SEC thi bo. */
+static void ctl_serve(int lfd, struct flight *f)
+{
+	static const char usage_msg[] = "lenh: dump\n";
+	struct timeval tv = { .tv_sec = CTL_IO_TIMEOUT_SEC };
+	char cmd[32];
+	ssize_t n;
+	int fd;
+
+	fd = accept4(lfd, NULL, NULL, SOCK_CLOEXEC);
+	if (fd < 0)
+		return;
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+	n = read(fd, cmd, sizeof(cmd) - 1);
+	if (n > 0) {
+		cmd[n] = '\0';
+		cmd[strcspn(cmd, "\r\n")] = '\0';
+		if (!strcmp(cmd, "dump"))
+			flight_dump(f, fd);
+		else
+			write_all(fd, usage_msg, sizeof(usage_msg) - 1);
+	}
+	close(fd);
+}
+
+static int run_flight(void)
+{
+	struct timespec tick = { .tv_sec = env.stats_sec };
+	struct pollfd pfd = { .fd = -1, .events = POLLIN };
+	sigset_t block, old;
+	char header[128];
+	struct flight *f;
+	int err;
+
+	f = flight_open(map_fds.flight_ring, map_fds.flight_head, env.flight, caps.batch_ops);
+	if (!f) {
+		fprintf(stderr, "Loi: khong cap phat duoc bo nho cho --flight\n");
+		return -ENOMEM;
+	}
+	if (env.ctl) {
+		pfd.fd = ctl_listen(env.ctl);
+		if (pfd.fd < 0) {
+			err = pfd.fd;
+			fprintf(stderr, "Loi: khong mo duoc socket %s (%d)\n", env.ctl, err);
+			goto out;
+		}
+	}
+	format_header(header, sizeof(header));
+	err = sinks_start(formatters, header);
+	if (err)
+		goto out;
+	/* Khong co consumer de do do tre: giu moi event. */
+	bpf_map_update_elem(map_fds.sample_ctl, &(__u32){ 0 },
+			    &(struct sample_ctl){ .rate = 1 }, BPF_ANY);
+	if (env.mem_budget)
+		mem_lock_and_report();
+	fprintf(stderr, "netlog: flight recorder %u event/CPU, kill -USR1 %d de dump\n",
+		env.flight, getpid());
+
+	/* Chan signal ngoai ppoll() de khong lo signal den giua luc kiem tra co
+	 * va luc ngu. */
+	sigemptyset(&block);
+	sigaddset(&block, SIGUSR1);
+	sigaddset(&block, SIGINT);
+	sigaddset(&block, SIGTERM);
+	sigprocmask(SIG_BLOCK, &block, &old);
+	while (!exiting) {
+		if (dump_req) {
+			dump_req = 0;
+			flight_dump(f, -1);
+		}
+		err = ppoll(&pfd, 1, env.stats_sec ? &tick : NULL, &old);
+		if (err < 0 && errno != EINTR) {
+			err = -errno;
+			fprintf(stderr, "Loi: ppoll: %d\n", err);
+			break;
+		}
+		if (err > 0)
+			ctl_serve(pfd.fd, f);
+		err = 0;
+		prog_stats_tick();
+	}
+	sigprocmask(SIG_SETMASK, &old, NULL);
+	if (env.mem_budget)
+		err = mem_check_steady(err);
+	sinks_stop();
+out:
+	if (pfd.fd >= 0) {
+		close(pfd.fd);
+		if (env.ctl[0] != '@')
+			unlink(env.ctl);
+	}
+	flight_close(f);
+	return err;
+}
+
+/*
+ * --raw: khong format, khong qua sink. Record trong ring duoc writev thang tu
+ * vung mmap ra file (netlog_ring.c), khong copy trong user-space. Khong co do
+ * tre tung event nen sampling chi dua vao do day cua ring.
+ *
+ * Ghi qua io_uring neu kernel cho: flash cham chi lam ring day len (sampler
+ * thay va tang rate), vong lap khong bi chan trong write(). Khong duoc thi
+ * ghi dong bo bang writev nhu cu.
+ */
+static void raw_report(const struct raw_ring_stats *st)
+{
+	unsigned int i;
+
+	fprintf(stderr, "raw: %llu record, %llu KiB, %llu writev%s, %llu discard\n",
+		(unsigned long long)st->records, (unsigned long long)st->bytes >> 10,
+		(unsigned long long)st->writes, st->uring ? " (io_uring)" : "",
+		(unsigned long long)st->discarded);
+	if (!st->uring)
+		return;
+	fprintf(stderr, "raw: so batch dang bay luc submit:");
+	for (i = 0; i < RAW_ASYNC_SLOTS; i++)
+		fprintf(stderr, " %u:%llu", i, (unsigned long long)st->depth_hist[i]);
+	fprintf(stderr, "\nraw: do tre ghi (us):");
+	for (i = 0; i < RAW_LAT_BUCKETS; i++)
+		if (st->lat_hist[i])
+			fprintf(stderr, " <%llu:%llu", 1ULL << (i + 1),
+				(unsigned long long)st->lat_hist[i]);
+	fprintf(stderr, "\n");
+}
+
+static int run_raw(int events_fd)
+{
+	struct raw_ring *r;
+	int out, err = 0;
+	bool async;
+	ssize_t n;
+
+	out = strcmp(env.raw, "-") ?
+	      open(env.raw, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644) : STDOUT_FILENO;
+	if (out < 0) {
+		fprintf(stderr, "Loi: khong mo duoc %s (%d)\n", env.raw, -errno);
+		return -errno;
+	}
+	r = raw_ring_open(events_fd);
+	if (!r) {
+		err = -errno;
+		fprintf(stderr, "Loi: khong mmap duoc ring buffer (%d)\n", err);
+		goto out;
+	}
+	err = raw_ring_uring_init(r, out);
+	async = !err;
+	if (err)
+		fprintf(stderr, "netlog: khong dung duoc io_uring (%d), ghi dong bo\n", err);
+	err = 0;
+	bpf_map_update_elem(map_fds.sample_ctl, &(__u32){ 0 },
+			    &(struct sample_ctl){ .rate = 1 }, BPF_ANY);
+	if (env.mem_budget)
+		mem_lock_and_report();
+
+	while (!exiting) {
+		err = raw_ring_wait(r, 200 /* ms */);
+		if (err == -EINTR) {
+			err = 0;
+			break;
+		}
+		if (err < 0) {
+			fprintf(stderr, "Loi khi poll ring buffer: %d\n", err);
+			break;
+		}
+		err = 0;
+		/* Do do day truoc khi tra cho, giong vong poll cua run_events. */
+		sampler_update(raw_ring_avail(r), raw_ring_size(r), clock_ns(CLOCK_BOOTTIME));
+		n = async ? raw_ring_async(r) : raw_ring_flush(r, out);
+		if (n < 0) {
+			err = n;
+			fprintf(stderr, "Loi: ghi %s: %d\n", env.raw, err);
+			break;
+		}
+		prog_stats_tick();
+	}
+	if (!err) {
+		n = async ? raw_ring_async_drain(r) : raw_ring_flush(r, out);
+		if (n < 0)
+			err = n;
+	}
+	if (env.mem_budget)
+		err = mem_check_steady(err);
+
+	raw_report(raw_ring_stats(r));
+	raw_ring_close(r);
+out:
+	if (out != STDOUT_FILENO)
+		close(out);
+	return err;
+}
+
+/*
+ * --pin DIR: lan chay dau (cold) load skeleton nhu binh thuong roi pin moi map,
+ * program va link vao DIR. Cac lan sau (warm) chi can mo lai object da pin:
+ * khong CO-RE relocate, khong verify, va ring buffer van giu event sinh ra
+ * trong luc netlog khong chay. Map .rodata duoc pin cuoi cung, vua la dau hieu
+ * bo pin da day du vua dung de kiem tra cau hinh (vd --top) khop voi lan truoc.
+ * Muon load lai program moi (doi cau hinh, nang cap) thi xoa DIR.
+ *
+ * Kernel < 5.15 attach kprobe qua perf_event nen link khong pin duoc; khi do
+ * warm start tu attach lai program da pin (van bo qua duoc load/verify) va
+ * connect xay ra giua 2 lan chay se khong duoc ghi.
+ */
+struct pinned_prog {
+	const char *name;   /* ten program trong skeleton */
+	const char *kfunc;  /* ham kprobe, dung khi phai attach lai */
+	const char *tp;     /* raw tracepoint; ca 2 NULL = fentry/tp_btf */
+	bool retprobe;      /* kfunc la kretprobe */
+};
+
+/* 2 program connect chi 1 duoc load (xem caps), program khong load thi khong
+ * co pin. */
+static const struct pinned_prog pinned_progs[] = {
+	{ "bpf_prog_tcp_connect", "tcp_connect", NULL, false },
+	{ "bpf_prog_tcp_connect_fentry", NULL, NULL, false },
+	{ "bpf_prog_tcp_close", NULL, "inet_sock_set_state", false },
+	{ "bpf_prog_tcp_close_btf", NULL, NULL, false },
+	{ "bpf_prog_tcp_retrans", NULL, "tcp_retransmit_skb", false },
+	{ "bpf_prog_tcp_send_reset", NULL, "tcp_send_reset", false },
+	{ "bpf_prog_tcp_recv_reset", NULL, "tcp_receive_reset", false },
+	{ "bpf_prog_tcp_accept", "inet_csk_accept", NULL, true },
+};
+
+#define PIN_PATH_MAX 256
+
+static int pin_path(char *buf, const char *kind, const char *name)
+{
+	int n = snprintf(buf, PIN_PATH_MAX, "%s/%s%s", env.pin_dir, kind, name);
+
+	return n < 0 || n >= PIN_PATH_MAX ? -ENAMETOOLONG : 0;
+}
+
+static void unpin_all(struct netlog_bpf *skel)
+{
+	char path[PIN_PATH_MAX];
+	struct bpf_program *prog;
+	struct bpf_map *map;
+
+	bpf_object__for_each_map(map, skel->obj)
+		if (!pin_path(path, "", bpf_map__name(map)))
+			unlink(path);
+	bpf_object__for_each_program(prog, skel->obj) {
+		if (!pin_path(path, "prog_", bpf_program__name(prog)))
+			unlink(path);
+		if (!pin_path(path, "link_", bpf_program__name(prog)))
+			unlink(path);
+	}
+}
+
+static int pin_all(struct netlog_bpf *skel)
+{
+	/* Cung thu tu voi pinned_progs. */
+	struct bpf_link *links[] = {
+		skel->links.bpf_prog_tcp_connect,
+		skel->links.bpf_prog_tcp_connect_fentry,
+		skel->links.bpf_prog_tcp_close,
+		skel->links.bpf_prog_tcp_close_btf,
+		skel->links.bpf_prog_tcp_retrans,
+		skel->links.bpf_prog_tcp_send_reset,
+		skel->links.bpf_prog_tcp_recv_reset,
+		skel->links.bpf_prog_tcp_accept,
+	};
+	char path[PIN_PATH_MAX];
+	struct bpf_program *prog;
+	struct bpf_map *map;
+	unsigned int i;
+	int err;
+
+	if (mkdir(env.pin_dir, 0700) && errno != EEXIST)
+		return -errno;
+
+	bpf_object__for_each_map(map, skel->obj) {
+		/* Map cua transport khong dung thi khong duoc tao. */
+		if (map == skel->maps.rodata || bpf_map__fd(map) < 0)
+			continue;
+		err = pin_path(path, "", bpf_map__name(map));
+		if (!err)
+			err = bpf_map__pin(map, path);
+		if (err)
+			goto fail;
+	}
+
+	bpf_object__for_each_program(prog, skel->obj) {
+		if (bpf_program__fd(prog) < 0)
+			continue;
+		err = pin_path(path, "prog_", bpf_program__name(prog));
+		if (!err)
+			err = bpf_obj_pin(bpf_program__fd(prog), path) ? -errno : 0;
+		if (err)
+			goto fail;
+	}
+
+	/* Link kprobe chi pin duoc khi kernel cap BPF link cho kprobe (>= 5.15),
+	 * link fentry luon pin duoc. */
+	for (i = 0; i < sizeof(links) / sizeof(links[0]); i++) {
+		if (links[i] && !pin_path(path, "link_", pinned_progs[i].name) &&
+		    bpf_link__pin(links[i], path))
+			fprintf(stderr, "netlog: kernel khong pin duoc link %s, "
+				"warm start se attach lai program da pin\n",
+				pinned_progs[i].name);
+	}
+
+	err = pin_path(path, "", bpf_map__name(skel->maps.rodata));
+	if (!err)
+		err = bpf_map__pin(skel->maps.rodata, path);
+	if (err)
+		goto fail;
+	return 0;
+
+fail:
+	unpin_all(skel);
+	return err;
+}
+
+static int pin_get(const char *kind, const char *name)
+{
+	char path[PIN_PATH_MAX];
+	int fd;
+
+	if (pin_path(path, kind, name))
+		return -ENAMETOOLONG;
+	fd = bpf_obj_get(path);
+	return fd < 0 ? -errno : fd;
+}
+
+/* Doc 1 so tu file cua PMU kprobe (type, format/retprobe). */
+static int kprobe_pmu_read(const char *file, const char *fmt, int *out)
+{
+	char path[128], buf[32] = {};
+	ssize_t n;
+	int fd;
+
+	snprintf(path, sizeof(path), "/sys/bus/event_source/devices/kprobe/%s", file);
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+	n = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	return n > 0 && sscanf(buf, fmt, out) == 1 ? 0 : -EINVAL;
+}
+
+/* Attach kprobe bang perf_event_open + PERF_EVENT_IOC_SET_BPF, khong can bpf_program. */
+static int attach_kprobe_fd(int prog_fd, const char *kfunc, bool retprobe)
+{
+	struct perf_event_attr attr = {};
+	int fd, type, bit, err;
+
+	err = kprobe_pmu_read("type", "%d", &type);
+	if (!err && retprobe)
+		err = kprobe_pmu_read("format/retprobe", "config:%d", &bit);
+	if (err)
+		return err;
+
+	attr.size = sizeof(attr);
+	attr.type = type;
+	if (retprobe)
+		attr.config |= 1ULL << bit;
+	attr.config1 = (__u64)(unsigned long)kfunc;
+	fd = syscall(__NR_perf_event_open, &attr, -1, 0, -1, PERF_FLAG_FD_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+	if (ioctl(fd, PERF_EVENT_IOC_SET_BPF, prog_fd) ||
+	    ioctl(fd, PERF_EVENT_IOC_ENABLE, 0)) {
+		int err = -errno;
+
+		close(fd);
+		return err;
+	}
+	return fd;
+}
+
+/*
+ * Warm start: tra ve 1 neu da dung duoc bo pin (map_fds da mo),
+ * 0 neu chua co bo pin day du (can cold start), < 0 neu loi.
+ * perf_fds giu cac kprobe attach lai, dong khi thoat.
+ */
+static int pin_reuse(struct netlog_bpf *skel, int *perf_fds)
+{
+	const struct bpf_map *rodata = skel->maps.rodata;
+	__u32 sz = bpf_map__value_size(rodata), zero = 0;
+	unsigned int i, attached = 0;
+	void *cur;
+	int fd, err;
+
+	fd = pin_get("", bpf_map__name(rodata));
+	if (fd == -ENOENT)
+		return 0;
+	if (fd < 0)
+		return fd;
+
+	cur = calloc(1, sz);
+	if (!cur) {
+		close(fd);
+		return -ENOMEM;
+	}
+	err = bpf_map_lookup_elem(fd, &zero, cur) ? -errno : 0;
+	if (!err && memcmp(cur, skel->rodata, sz)) {
+		fprintf(stderr, "Loi: cau hinh khac voi program da pin trong %s, "
+			"xoa thu muc do de load lai\n", env.pin_dir);
+		err = -EINVAL;
+	}
+	free(cur);
+	close(fd);
+	if (err)
+		return err;
+
+	map_fds.events = pin_get("", xp.perfbuf ? "events_perf" : "events");
+	map_fds.top_talkers = pin_get("", "top_talkers");
+	map_fds.sample_ctl = pin_get("", "sample_ctl");
+	map_fds.cgroup_stats = pin_get("", "cgroup_stats");
+	map_fds.netns_stats = pin_get("", "netns_stats");
+	if (map_fds.events < 0)
+		return map_fds.events;
+	if (map_fds.top_talkers < 0)
+		return map_fds.top_talkers;
+	if (map_fds.sample_ctl < 0)
+		return map_fds.sample_ctl;
+	if (map_fds.cgroup_stats < 0)
+		return map_fds.cgroup_stats;
+	if (map_fds.netns_stats < 0)
+		return map_fds.netns_stats;
+	if (env.flight) {
+		map_fds.flight_ring = pin_get("", "flight_ring");
+		map_fds.flight_head = pin_get("", "flight_head");
+		if (map_fds.flight_ring < 0)
+			return map_fds.flight_ring;
+		if (map_fds.flight_head < 0)
+			return map_fds.flight_head;
+	}
+	if (env.retrans_sec) {
+		map_fds.dest_stats = pin_get("", "dest_stats");
+		if (map_fds.dest_stats < 0)
+			return map_fds.dest_stats;
+	}
+	/* Khong co pin (kernel khong co iterator) thi dung /proc. */
+	snap_prog_fd = pin_get("prog_", "bpf_iter_tcp");
+	if (env.batch) {
+		map_fds.batch_ts = pin_get("", "batch_ts");
+		bat.prog_fd = pin_get("prog_", "bpf_prog_batch_flush");
+		if (map_fds.batch_ts < 0)
+			return map_fds.batch_ts;
+		if (bat.prog_fd < 0)
+			return bat.prog_fd;
+	}
+
+	for (i = 0; i < sizeof(pinned_progs) / sizeof(pinned_progs[0]); i++) {
+		int prog_fd;
+
+		fd = pin_get("link_", pinned_progs[i].name);
+		if (fd >= 0) {
+			/* Link con song trong bpffs, program van dang chay. */
+			close(fd);
+			attached++;
+			continue;
+		}
+		prog_fd = pin_get("prog_", pinned_progs[i].name);
+		if (prog_fd == -ENOENT)
+			continue;   /* duong attach kia */
+		if (prog_fd < 0)
+			return prog_fd;
+		if (pinned_progs[i].kfunc) {
+			perf_fds[i] = attach_kprobe_fd(prog_fd, pinned_progs[i].kfunc,
+						       pinned_progs[i].retprobe);
+		} else {
+			perf_fds[i] = bpf_raw_tracepoint_open(pinned_progs[i].tp, prog_fd);
+			if (perf_fds[i] < 0)
+				perf_fds[i] = -errno;
+		}
+		close(prog_fd);
+		if (perf_fds[i] < 0)
+			return perf_fds[i];
+		attached++;
+	}
+	return attached ? 1 : -ENOENT;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Cach dung: %s [-r MS] [-c N] [-t [N]] [-p DIR] [-o OUTPUT]... [-m SIZE] [-s [SEC]]\n"
+		"          [-S] [-w FILE] [-u UID] [-d PORT] [-g CGROUP] [--no-pkg] [--no-ipv6]\n"
+		"          [-k [FILE]] [--perfbuf] [-F [N] [--ctl SOCKET]] [-b [K] [--batch-age MS]]\n"
+		"          [--no-snapshot] [-U [SEC]] [-f] [-R [SEC]] [--udp] [-i] [-n] [-H [T]]\n"
+		"  -r, --reorder-ms MS   sap xep event theo ts, tre toi da MS ms (0 = tat)\n"
+		"  -c, --reorder-cap N   so event toi da trong reorder buffer (mac dinh %d)\n"
+		"  -t, --top[=N]         man hinh top N (pkg, daddr, dport) theo connect/s\n"
+		"                        (mac dinh %d), dem trong kernel, khong stream event\n"
+		"  -H, --heavy[=T]       --top dem bang count-min sketch %dx%d moi CPU: chi flow\n"
+		"                        >= T connect/s tren 1 CPU (mac dinh %d) len user-space,\n"
+		"                        bo nho co dinh du nhieu dich toi dau\n"
+		"  -S, --scopes          connect/s theo cgroup (container) va netns,\n"
+		"                        dem trong kernel, khong stream event\n"
+		"  -U, --usage[=SEC]     byte/s theo (uid, protocol) moi SEC giay (mac dinh 1),\n"
+		"                        dem trong cgroup_skb tai goc cgroup2 (hoac -g)\n"
+		"  -R, --retrans[=SEC]   gui lai va RST/s theo (uid, daddr, dport) moi SEC giay\n"
+		"                        (mac dinh 1), dem trong kernel, khong stream event\n"
+		"  -p, --pin DIR         pin map/program vao bpffs (vd /sys/fs/bpf/netlog)\n"
+		"                        va dung lai o lan chay sau, khong load lai\n"
+		"  -o, --output SPEC     them output (co the lap lai, mac dinh stdout):\n"
+		"                        stdout | file:PATH | unix:PATH, them tuy chon\n"
+		"                        ,policy=block|drop-newest|drop-oldest|sample:N\n"
+		"                        ,format=text|json ,queue=N\n"
+		"  -w, --raw FILE        ghi record nhi phan cua ring buffer ra FILE (- = stdout)\n"
+		"                        bang writev tu vung mmap, khong format, khong copy,\n"
+		"                        qua io_uring neu kernel cho\n"
+		"  -F, --flight[=N]      flight recorder: probe giu N event gan nhat moi CPU\n"
+		"                        trong kernel (mac dinh %d), khong stream; SIGUSR1\n"
+		"                        thi dump ra cac output -o theo thu tu ts\n"
+		"      --ctl SOCKET      voi --flight: nghe unix SOCKET (@ten = abstract),\n"
+		"                        lenh \"dump\" tra ve dump tren ket noi do\n"
+		"  -b, --batch[=K]       probe gom toi da K event (mac dinh %d) moi CPU vao 1\n"
+		"                        record ring buffer, bot tranh chap reserve/submit\n"
+		"      --batch-age MS    batch cu hon MS ms thi bi flush (mac dinh %d)\n"
+		"  -m, --mem-budget SIZE chia ring buffer va moi buffer tu SIZE (vd 4M),\n"
+		"                        cap phat truoc va mlock, bao cao luc khoi dong\n"
+		"  -s, --prog-stats[=SEC] moi SEC giay (mac dinh 5) in ns/lan, lan/s va\n"
+		"                        %% CPU cua tung program BPF\n"
+		"  -u, --uid UID         chi ghi connect cua UID\n"
+		"  -d, --dport PORT      chi ghi connect toi PORT\n"
+		"  -g, --cgroup PATH     chi ghi connect tu cgroup v2 PATH va cgroup con\n"
+		"                        (voi --usage: chi dem goi cua PATH)\n"
+		"                        (path tuyet doi hoac tinh tu goc cgroup2)\n"
+		"      --no-pkg          khong doc argv lay pkg (pkg = rong)\n"
+		"      --no-ipv6         bo qua connect IPv6\n"
+		"  -k, --packages[=FILE] lay pkg theo uid tu FILE (mac dinh %s),\n"
+		"                        probe khong doc argv nua; nap lai khi FILE doi\n"
+		"      --perfbuf         dung perf buffer du kernel co ring buffer\n"
+		"  -f, --flows           them 1 dong luc moi ket noi da in dong lai: thoi gian,\n"
+		"                        byte gui/ack/nhan, srtt, so lan gui lai (tu tcp_sock)\n"
+		"  -i, --inbound         them ket noi TCP duoc accept() (\"<-\", dir=in), cung loc,\n"
+		"                        --top/--scopes va sampling; -d la port local\n"
+		"      --udp             them UDP/QUIC: datagram dau tien cua moi (socket, dich),\n"
+		"                        bat o cgroup_skb egress (pid/comm rong, pkg theo -k)\n"
+		"  -n, --dns             bat tra loi DNS (UDP 53, A/AAAA) de in host=ten cua daddr,\n"
+		"                        cache theo TTL (toi da %d dia chi)\n"
+		"      --no-snapshot     khong in cac socket TCP da mo luc khoi dong\n"
+		"                        (mac dinh in, snap=STATE, qua bpf_iter hoac /proc)\n"
+		"  Transport (ring/perf buffer), attach (fentry/kprobe) va cach doc map\n"
+		"  duoc chon tu dong theo tinh nang kernel do luc khoi dong.\n"
+		"  Cac tuy chon loc duoc bien dich vao probe luc load (.rodata), tat thi\n"
+		"  khong ton lenh nao trong kernel.\n",
+		prog, REORDER_CAP_DEFAULT, TOP_N_DEFAULT, CMS_DEPTH, CMS_WIDTH,
+		HEAVY_THRESH_DEFAULT, FLIGHT_SLOTS_DEFAULT,
+		BATCH_MAX, BATCH_AGE_MS_DEFAULT, PACKAGES_LIST_DEFAULT, DNS_CACHE_CAP);
+}
+
+static int parse_args(int argc, char **argv)
+{
+	static const struct option opts[] = {
+		{ "reorder-ms",  required_argument, NULL, 'r' },
+		{ "reorder-cap", required_argument, NULL, 'c' },
+		{ "top",         optional_argument, NULL, 't' },
+		{ "pin",         required_argument, NULL, 'p' },
+		{ "output",      required_argument, NULL, 'o' },
+		{ "mem-budget",  required_argument, NULL, 'm' },
+		{ "prog-stats",  optional_argument, NULL, 's' },
+		{ "uid",         required_argument, NULL, 'u' },
+		{ "dport",       required_argument, NULL, 'd' },
+		{ "scopes",      no_argument,       NULL, 'S' },
+		{ "raw",         required_argument, NULL, 'w' },
+		{ "cgroup",      required_argument, NULL, 'g' },
+		{ "no-pkg",      no_argument,       NULL, 'P' },
+		{ "no-ipv6",     no_argument,       NULL, '6' },
+		{ "packages",    optional_argument, NULL, 'k' },
+		{ "perfbuf",     no_argument,       NULL, 'B' },
+		{ "flight",      optional_argument, NULL, 'F' },
+		{ "ctl",         required_argument, NULL, 'C' },
+		{ "batch",       optional_argument, NULL, 'b' },
+		{ "batch-age",   required_argument, NULL, 'A' },
+		{ "no-snapshot", no_argument,       NULL, 'N' },
+		{ "usage",       optional_argument, NULL, 'U' },
+		{ "flows",       no_argument,       NULL, 'f' },
+		{ "retrans",     optional_argument, NULL, 'R' },
+		{ "udp",         no_argument,       NULL, 'Q' },
+		{ "inbound",     no_argument,       NULL, 'i' },
+		{ "dns",         no_argument,       NULL, 'n' },
+		{ "heavy",       optional_argument, NULL, 'H' },
+		{ "help",        no_argument,       NULL, 'h' },
+		{},
+	};
+	int opt;
+
+	while ((opt = getopt_long(argc, argv, "r:c:t::p:o:m:s::u:d:Sw:g:k::F::b::U::fR::inH::h", opts, NULL)) != -1) {
+		switch (opt) {
+		case 'r':
+			env.reorder_ms = strtoul(optarg, NULL, 0);
+			break;
+		case 'c':
+			env.reorder_cap = strtoul(optarg, NULL, 0);
+			if (!env.reorder_cap) {
+				fprintf(stderr, "Loi: --reorder-cap phai > 0\n");
+				return -EINVAL;
+			}
+			break;
+		case 't':
+			env.top_n = optarg ? strtoul(optarg, NULL, 0) : TOP_N_DEFAULT;
+			if (!env.top_n) {
+				fprintf(stderr, "Loi: --top N phai > 0\n");
+				return -EINVAL;
+			}
+			break;
+		case 'p':
+			env.pin_dir = optarg;
+			break;
+		case 'o':
+			if (sink_add(optarg))
+				return -EINVAL;
+			break;
+		case 'm':
+			if (parse_size(optarg, &env.mem_budget)) {
+				fprintf(stderr, "Loi: --mem-budget khong hop le: '%s'\n", optarg);
+				return -EINVAL;
+			}
+			break;
+		case 's':
+			env.stats_sec = optarg ? strtoul(optarg, NULL, 0) : 5;
+			if (!env.stats_sec) {
+				fprintf(stderr, "Loi: --prog-stats SEC phai > 0\n");
+				return -EINVAL;
+			}
+			break;
+		case 'u':
+			env.filter_uid = strtoul(optarg, NULL, 0);
+			break;
+		case 'd':
+			env.filter_dport = strtoul(optarg, NULL, 0);
+			if (!env.filter_dport) {
+				fprintf(stderr, "Loi: --dport phai > 0\n");
+				return -EINVAL;
+			}
+			break;
+		case 'S':
+			env.scopes = true;
+			break;
+		case 'w':
+			env.raw = optarg;
+			break;
+		case 'g':
+			env.filter_cgroup = optarg;
+			break;
+		case 'P':
+			env.no_pkg = true;
+			break;
+		case '6':
+			env.no_ipv6 = true;
+			break;
+		case 'k':
+			env.packages = optarg ? optarg : PACKAGES_LIST_DEFAULT;
+			break;
+		case 'B':
+			env.perfbuf = true;
+			break;
+		case 'F':
+			env.flight = optarg ? strtoul(optarg, NULL, 0) : FLIGHT_SLOTS_DEFAULT;
+			if (env.flight < 2 || env.flight & (env.flight - 1)) {
+				fprintf(stderr, "Loi: --flight N phai la luy thua cua 2, >= 2\n");
+				return -EINVAL;
+			}
+			break;
+		case 'C':
+			env.ctl = optarg;
+			break;
+		case 'b':
+			env.batch = optarg ? strtoul(optarg, NULL, 0) : BATCH_MAX;
+			if (env.batch < 2 || env.batch > BATCH_MAX) {
+				fprintf(stderr, "Loi: --batch K phai trong 2..%d\n", BATCH_MAX);
+				return -EINVAL;
+			}
+			break;
+		case 'N':
+			env.no_snapshot = true;
+			break;
+		case 'f':
+			env.flows = true;
+			break;
+		case 'Q':
+			env.udp = true;
+			break;
+		case 'i':
+			env.inbound = true;
+			break;
+		case 'n':
+			env.dns = true;
+			break;
+		case 'R':
+			env.retrans_sec = optarg ? strtoul(optarg, NULL, 0) : 1;
+			if (!env.retrans_sec) {
+				fprintf(stderr, "Loi: --retrans SEC phai > 0\n");
+				return -EINVAL;
+			}
+			break;
+		case 'U':
+			env.usage_sec = optarg ? strtoul(optarg, NULL, 0) : 1;
+			if (!env.usage_sec) {
+				fprintf(stderr, "Loi: --usage SEC phai > 0\n");
+				return -EINVAL;
+			}
+			break;
+		case 'H':
+			env.heavy_thresh = optarg ? strtoul(optarg, NULL, 0) : HEAVY_THRESH_DEFAULT;
+			if (!env.heavy_thresh) {
+				fprintf(stderr, "Loi: --heavy T phai > 0\n");
+				return -EINVAL;
+			}
+			break;
+		case 'A':
+			env.batch_age_ms = strtoul(optarg, NULL, 0);
+			if (!env.batch_age_ms) {
+				fprintf(stderr, "Loi: --batch-age phai > 0\n");
+				return -EINVAL;
+			}
+			break;
+		default:
+			usage(argv[0]);
+			return -EINVAL;
+		}
+	}
+	/* --heavy la --top voi cach dem khac. */
+	if (env.heavy_thresh && !env.top_n)
+		env.top_n = TOP_N_DEFAULT;
+	if (!!env.top_n + env.scopes + !!env.raw + !!env.flight + !!env.usage_sec +
+	    !!env.retrans_sec > 1) {
+		fprintf(stderr, "Loi: chi dung mot trong --top, --scopes, --raw, --flight, "
+			"--usage, --retrans\n");
+		return -EINVAL;
+	}
+	/* Map cms va epoch chi song trong phien nay. */
+	if (env.heavy_thresh && env.pin_dir) {
+		fprintf(stderr, "Loi: --heavy khong dung voi --pin\n");
+		return -EINVAL;
+	}
+	/* Tracepoint gui lai/RST chay trong softirq, task hien tai khong lien quan. */
+	if (env.retrans_sec && (env.filter_cgroup || env.batch)) {
+		fprintf(stderr, "Loi: --retrans khong dung voi --cgroup, --batch\n");
+		return -EINVAL;
+	}
+	/* Link cgroup gan voi phien nay, va program cgroup_skb khong co port. */
+	if (env.usage_sec && (env.pin_dir || env.filter_dport || env.batch)) {
+		fprintf(stderr, "Loi: --usage khong dung voi --pin, --dport, --batch\n");
+		return -EINVAL;
+	}
+	if (env.ctl && !env.flight) {
+		fprintf(stderr, "Loi: --ctl chi dung voi --flight\n");
+		return -EINVAL;
+	}
+	if (env.batch && (env.top_n || env.scopes || env.raw || env.flight)) {
+		fprintf(stderr, "Loi: --batch chi dung khi stream event (khong --top, "
+			"--scopes, --raw, --flight)\n");
+		return -EINVAL;
+	}
+	if (env.flows && (env.top_n || env.scopes || env.raw || env.flight || env.usage_sec ||
+			  env.retrans_sec)) {
+		fprintf(stderr, "Loi: --flows chi dung khi stream event (khong --top, "
+			"--scopes, --raw, --flight, --usage, --retrans)\n");
+		return -EINVAL;
+	}
+	if (env.inbound && (env.usage_sec || env.retrans_sec)) {
+		fprintf(stderr, "Loi: --inbound khong dung voi --usage, --retrans\n");
+		return -EINVAL;
+	}
+	/* Link cgroup gan voi phien nay, xem --usage. */
+	if (env.udp && (env.top_n || env.scopes || env.usage_sec || env.retrans_sec ||
+			env.pin_dir)) {
+		fprintf(stderr, "Loi: --udp chi dung khi stream event (khong --top, --scopes, "
+			"--usage, --retrans) va khong dung voi --pin\n");
+		return -EINVAL;
+	}
+	if (env.dns && (env.top_n || env.scopes || env.raw || env.flight || env.usage_sec ||
+			env.retrans_sec || env.pin_dir)) {
+		fprintf(stderr, "Loi: --dns chi dung khi stream event (khong --top, --scopes, "
+			"--raw, --flight, --usage, --retrans) va khong dung voi --pin\n");
+		return -EINVAL;
+	}
+	if (env.flight && env.reorder_ms) {
+		fprintf(stderr, "Loi: dump cua --flight da sap xep theo ts, khong dung -r\n");
+		return -EINVAL;
+	}
+	if (env.raw && (sinks_count() || env.reorder_ms || env.packages)) {
+		fprintf(stderr, "Loi: --raw khong format nen khong dung voi -o, -r, -k\n");
+		return -EINVAL;
+	}
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	int perf_fds[sizeof(pinned_progs) / sizeof(pinned_progs[0])];
+	struct netlog_bpf *skel;
+	unsigned int i;
+	int err;
+
+	startup.t0 = clock_ns(CLOCK_MONOTONIC);
+	for (i = 0; i < sizeof(perf_fds) / sizeof(perf_fds[0]); i++)
+		perf_fds[i] = -1;
+
+	if (parse_args(argc, argv))
+		return 1;
+
+	libbpf_set_print(libbpf_print_fn);
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+	signal(SIGUSR1, env.flight ? on_dump : SIG_IGN);
+
+	clock_resync();
+
+	caps_probe(&caps);
+	caps_log(&caps);
+	xp.perfbuf = !caps.ringbuf || env.perfbuf;
+	if (xp.perfbuf && !caps.perfbuf) {
+		fprintf(stderr, "Loi: kernel khong co ca ring buffer lan perf buffer\n");
+		return 1;
+	}
+	if (xp.perfbuf && (env.raw || env.batch)) {
+		fprintf(stderr, "Loi: %s can ring buffer (kernel >= 5.8)\n",
+			env.raw ? "--raw" : "--batch");
+		return 1;
+	}
+	if (env.flows && !caps.tp_inet_sock_set_state) {
+		fprintf(stderr, "Loi: --flows can tracepoint inet_sock_set_state\n");
+		return 1;
+	}
+	if (env.retrans_sec && !caps.tp_tcp_retransmit_skb && !caps.tp_tcp_send_reset &&
+	    !caps.tp_tcp_receive_reset) {
+		fprintf(stderr, "Loi: --retrans can tracepoint tcp_retransmit_skb/"
+			"tcp_send_reset/tcp_receive_reset\n");
+		return 1;
+	}
+	fprintf(stderr, "netlog: transport %s, attach %s, doc map %s\n",
+		xp.perfbuf ? "perf buffer" : "ring buffer",
+		caps.fentry ? "fentry" : "kprobe",
+		caps.batch_ops ? "batch" : "tung key");
+
+	/* open() chi parse ELF nhung trong binary, khong ton chi phi nhu load(). */
+	skel = netlog_bpf__open();
+	if (!skel) {
+		fprintf(stderr, "Loi: khong mo duoc BPF skeleton\n");
+		return 1;
+	}
+
+	/* Co packages.list thi probe khong can doc argv (--top van can vi key
+	 * top_talkers khong co uid). */
+	skel->rodata->capture_pkg = !env.no_pkg && (!env.packages || env.top_n);
+	skel->rodata->enable_ipv6 = !env.no_ipv6;
+	/* bpf_get_socket_cookie chi goi duoc tu program TRACING (>= 5.12): dung
+	 * khi connect di qua fentry va khong co --inbound (kretprobe accept), con
+	 * lai probe tu sinh flow id (xem new_flow_id()). */
+	skel->rodata->use_cookie = caps.socket_cookie && caps.fentry && !env.inbound;
+	skel->rodata->use_perfbuf = xp.perfbuf;
+	skel->rodata->flight = env.flight;
+	if (env.flight) {
+		skel->rodata->flight_mask = env.flight - 1;
+		bpf_map__set_max_entries(skel->maps.flight_ring, env.flight);
+	} else {
+		bpf_map__set_autocreate(skel->maps.flight_ring, false);
+		bpf_map__set_autocreate(skel->maps.flight_head, false);
+	}
+	/* Snapshot chi dung khi stream event, xem run_events(). */
+	if (!caps.iter_tcp || env.no_snapshot || env.top_n || env.scopes || env.raw ||
+	    env.flight || env.usage_sec || env.retrans_sec)
+		bpf_program__set_autoload(skel->progs.bpf_iter_tcp, false);
+	else
+		bpf_program__set_autoattach(skel->progs.bpf_iter_tcp, false);
+	skel->rodata->track_flows = env.flows;
+	if (!env.flows) {
+		bpf_map__set_autocreate(skel->maps.open_flows, false);
+		bpf_program__set_autoload(skel->progs.bpf_prog_tcp_close, false);
+		bpf_program__set_autoload(skel->progs.bpf_prog_tcp_close_btf, false);
+	} else {
+		/* Hook dong phai ra cung flow id voi hook connect. */
+		bpf_program__set_autoload(skel->rodata->use_cookie ?
+					  skel->progs.bpf_prog_tcp_close :
+					  skel->progs.bpf_prog_tcp_close_btf, false);
+	}
+	skel->rodata->batch_max = env.batch;
+	skel->rodata->batch_age_ns = env.batch_age_ms * NSEC_PER_MSEC;
+	if (!env.batch) {
+		bpf_map__set_autocreate(skel->maps.batch_stage, false);
+		bpf_map__set_autocreate(skel->maps.batch_ts, false);
+		bpf_program__set_autoload(skel->progs.bpf_prog_batch_flush, false);
+	}
+	bpf_map__set_autocreate(xp.perfbuf ? skel->maps.events : skel->maps.events_perf, false);
+	bpf_program__set_autoload(caps.fentry ? skel->progs.bpf_prog_tcp_connect :
+				  skel->progs.bpf_prog_tcp_connect_fentry, false);
+	/* --usage chi can 2 program cgroup_skb, --retrans chi can tracepoint gui
+	 * lai/RST; cac che do khac thi nguoc lai. */
+	if (env.usage_sec || env.retrans_sec) {
+		bpf_program__set_autoload(skel->progs.bpf_prog_tcp_connect, false);
+		bpf_program__set_autoload(skel->progs.bpf_prog_tcp_connect_fentry, false);
+	}
+	if (!env.usage_sec) {
+		bpf_map__set_autocreate(skel->maps.usage_stats, false);
+		bpf_program__set_autoload(skel->progs.bpf_prog_usage_ingress, false);
+		bpf_program__set_autoload(skel->progs.bpf_prog_usage_egress, false);
+	}
+	if (!env.retrans_sec)
+		bpf_map__set_autocreate(skel->maps.dest_stats, false);
+	skel->rodata->inbound = env.inbound;
+	if (!env.inbound)
+		bpf_program__set_autoload(skel->progs.bpf_prog_tcp_accept, false);
+	if (!env.dns)
+		bpf_program__set_autoload(skel->progs.bpf_prog_dns_ingress, false);
+	if (!env.udp) {
+		bpf_map__set_autocreate(skel->maps.udp_seen, false);
+		bpf_program__set_autoload(skel->progs.bpf_prog_udp_egress, false);
+	}
+	if (!env.retrans_sec || !caps.tp_tcp_retransmit_skb)
+		bpf_program__set_autoload(skel->progs.bpf_prog_tcp_retrans, false);
+	if (!env.retrans_sec || !caps.tp_tcp_send_reset)
+		bpf_program__set_autoload(skel->progs.bpf_prog_tcp_send_reset, false);
+	if (!env.retrans_sec || !caps.tp_tcp_receive_reset)
+		bpf_program__set_autoload(skel->progs.bpf_prog_tcp_recv_reset, false);
+	skel->rodata->filter_uid = env.filter_uid;
+	skel->rodata->filter_dport = env.filter_dport;
+	if (env.filter_cgroup && !env.usage_sec) {
+		__u64 id;
+		__u32 level;
+
+		err = cgroup_resolve(env.filter_cgroup, &id, &level);
+		if (err) {
+			fprintf(stderr, "Loi: khong tim duoc cgroup v2 '%s' (%d)\n",
+				env.filter_cgroup, err);
+			goto cleanup;
+		}
+		skel->rodata->filter_cgroup = id;
+		skel->rodata->filter_cgroup_level = level;
+	}
+	skel->rodata->heavy_thresh = env.heavy_thresh;
+	if (!env.heavy_thresh)
+		bpf_map__set_autocreate(skel->maps.cms, false);
+	if (env.top_n) {
+		skel->rodata->emit_events = false;
+		skel->rodata->count_talkers = !env.heavy_thresh;
+	} else if (env.scopes) {
+		skel->rodata->emit_events = false;
+		skel->rodata->count_by_scope = true;
+	} else if (env.usage_sec || env.retrans_sec) {
+		skel->rodata->emit_events = false;
+	} else if (!env.raw && !sinks_count()) {
+		sink_add("stdout");
+	}
+	/* LRU hash cap phat truoc luc tao map: top_talkers (~2 MB) chi --top dem
+	 * trong map can, flow_ids chi khi co event va khong co socket cookie. */
+	if (!skel->rodata->count_talkers)
+		bpf_map__set_max_entries(skel->maps.top_talkers, 1);
+	if (skel->rodata->use_cookie || !skel->rodata->emit_events)
+		bpf_map__set_max_entries(skel->maps.flow_ids, 1);
+
+	if (env.packages && !env.top_n && !env.scopes) {
+		err = pkgdb_open(env.packages);
+		if (err) {
+			fprintf(stderr, "Loi: khong doc duoc %s (%d)\n", env.packages, err);
+			goto cleanup;
+		}
+		fprintf(stderr, "netlog: %s, %u uid\n", env.packages, pkgdb_count());
+	}
+
+	if (env.mem_budget) {
+		err = mem_plan(skel);
+		if (err)
+			goto cleanup;
+	}
+
+	if (env.reorder_ms && !env.top_n && !env.scopes && !env.usage_sec && !env.retrans_sec &&
+	    reorder_init(env.reorder_ms, env.reorder_cap)) {
+		fprintf(stderr, "Loi: khong cap phat duoc reorder buffer\n");
+		err = -ENOMEM;
+		goto cleanup;
+	}
+
+	if (env.pin_dir) {
+		err = pin_reuse(skel, perf_fds);
+		if (err < 0) {
+			fprintf(stderr, "Loi: khong dung lai duoc object pin trong %s (%d)\n",
+				env.pin_dir, err);
+			goto cleanup;
+		}
+		startup.warm = err;
+	}
+
+	if (!startup.warm) {
+		err = netlog_bpf__load(skel);
+		if (err) {
+			fprintf(stderr, "Loi: khong load duoc BPF skeleton (%d)\n", err);
+			goto cleanup;
+		}
+
+		err = netlog_bpf__attach(skel);
+		if (err) {
+			fprintf(stderr, "Loi: khong attach duoc kprobe (%d)\n", err);
+			goto cleanup;
+		}
+		if (env.usage_sec || env.udp || env.dns) {
+			err = cgroup_skb_attach(skel);
+			if (err) {
+				fprintf(stderr, "Loi: khong attach duoc cgroup_skb vao %s (%d)\n",
+					env.filter_cgroup ? env.filter_cgroup : "goc cgroup2", err);
+				goto cleanup;
+			}
+		}
+
+		if (env.pin_dir) {
+			err = pin_all(skel);
+			if (err) {
+				fprintf(stderr, "Loi: khong pin duoc vao %s (%d)\n",
+					env.pin_dir, err);
+				goto cleanup;
+			}
+		}
+		map_fds.events = bpf_map__fd(xp.perfbuf ? skel->maps.events_perf :
+						  skel->maps.events);
+		map_fds.top_talkers = bpf_map__fd(skel->maps.top_talkers);
+		map_fds.sample_ctl = bpf_map__fd(skel->maps.sample_ctl);
+		map_fds.cgroup_stats = bpf_map__fd(skel->maps.cgroup_stats);
+		map_fds.netns_stats = bpf_map__fd(skel->maps.netns_stats);
+		map_fds.flight_ring = bpf_map__fd(skel->maps.flight_ring);
+		map_fds.flight_head = bpf_map__fd(skel->maps.flight_head);
+		map_fds.batch_ts = bpf_map__fd(skel->maps.batch_ts);
+		map_fds.usage_stats = bpf_map__fd(skel->maps.usage_stats);
+		map_fds.dest_stats = bpf_map__fd(skel->maps.dest_stats);
+		bat.prog_fd = bpf_program__fd(skel->progs.bpf_prog_batch_flush);
+		snap_prog_fd = bpf_program__fd(skel->progs.bpf_iter_tcp);
+	}
+
+	if (env.stats_sec) {
+		struct bpf_program *prog;
+
+		if (startup.warm) {
+			for (i = 0; i < sizeof(pinned_progs) / sizeof(pinned_progs[0]); i++)
+				prog_stats_add(pin_get("prog_", pinned_progs[i].name),
+					       pinned_progs[i].name);
+		} else {
+			bpf_object__for_each_program(prog, skel->obj)
+				prog_stats_add(bpf_program__fd(prog), bpf_program__name(prog));
+		}
+		err = prog_stats_start();
+		if (err)
+			goto cleanup;
+	}
+
+	fprintf(stderr, "netlog: %s start, san sang sau %.1f ms\n",
+		startup.warm ? "warm" : "cold",
+		(clock_ns(CLOCK_MONOTONIC) - startup.t0) / 1e6);
+
+	if (env.heavy_thresh)
+		err = run_heavy(map_fds.events);
+	else if (env.top_n)
+		err = run_top(map_fds.top_talkers,
+			      bpf_map__max_entries(skel->maps.top_talkers));
+	else if (env.scopes)
+		err = run_scopes();
+	else if (env.usage_sec)
+		err = run_usage();
+	else if (env.retrans_sec)
+		err = run_retrans();
+	else if (env.raw)
+		err = run_raw(map_fds.events);
+	else if (env.flight)
+		err = run_flight();
+	else
+		err = run_events(map_fds.events);
+
+cleanup:
+	if (ro.heap) {
+		if (ro.late)
+			fprintf(stderr, "reorder: %llu event den tre hon max delay\n",
+				(unsigned long long)ro.late);
+		free(ro.heap);
+	}
+	for (i = 0; i < sizeof(perf_fds) / sizeof(perf_fds[0]); i++)
+		if (perf_fds[i] >= 0)
+			close(perf_fds[i]);
+	prog_stats_stop();
+	pkgdb_close();
+	if (startup.warm) {
+		close(map_fds.events);
+		close(map_fds.top_talkers);
+		close(map_fds.sample_ctl);
+		close(map_fds.cgroup_stats);
+		close(map_fds.netns_stats);
+		close(map_fds.flight_ring);
+		close(map_fds.flight_head);
+		close(map_fds.batch_ts);
+		close(map_fds.dest_stats);
+		close(bat.prog_fd);
+		close(snap_prog_fd);
+		for (i = 0; i < (unsigned int)pst.nr; i++)
+			close(pst.fds[i]);
+	}
 	netlog_bpf__destroy(skel);
 	return err < 0 ? 1 : 0;
 }
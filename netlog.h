@@ -4,15 +4,106 @@
 #define TASK_COMM_LEN 16
 #define PKG_NAME_LEN  128
 
+#define TOP_TALKERS_MAX 10240
+#define SCOPE_STATS_MAX 1024    /* so cgroup / netns toi da trong map dem */
+#define FLOW_IDS_MAX    16384   /* sk -> flow id khi khong co socket cookie */
+#define FLIGHT_SLOTS_DEFAULT 1024 /* --flight: event giu lai tren moi CPU, luy thua 2 */
+#define BATCH_MAX       16      /* --batch: so event toi da trong 1 record ring */
+#define USAGE_STATS_MAX 4096    /* --usage: so cap (uid, protocol) toi da */
+#define DEST_STATS_MAX  4096    /* --retrans: so (uid, daddr, dport) toi da */
+#define DNS_NAME_LEN    96      /* --dns: QNAME giu lai, dang label tren goi */
+#define CMS_DEPTH       4       /* --heavy: so hang cua count-min sketch */
+#define CMS_WIDTH       2048    /* --heavy: so o moi hang, luy thua 2 */
+#define HEAVY_THRESH_DEFAULT 32 /* --heavy: connect/giay tren 1 CPU */
+#define HEAVY_FLOWS_MAX 1024    /* --heavy: flow vuot nguong toi da moi giay */
+
+/* struct event.dir, flow_rec.dir, talker_key.dir */
+#define DIR_OUT         0       /* tcp_connect, UDP gui di */
+#define DIR_IN          1       /* --inbound: socket duoc accept() */
+
+/* Flow id tu sinh co bit cao: khong trung voi socket cookie cua kernel. */
+#define FLOW_ID_LOCAL   (1ULL << 63)
+#define FILTER_UID_NONE 0xffffffffU
+
+/* struct event.kind */
+#define EVENT_CONNECT   0
+#define EVENT_SNAPSHOT  1       /* socket da co luc netlog khoi dong (bpf_iter/proc) */
+#define EVENT_CLOSE     2       /* --flows: ket noi TCP da dong, co event.flow */
+
+/* Counter cua 1 ket noi luc dong, kernel da dem san trong tcp_sock. */
+struct tcp_flow_stats {
+	__u64 duration_ns;      /* tu connect toi TCP_CLOSE */
+	__u64 bytes_sent;       /* ca phan gui lai */
+	__u64 bytes_acked;
+	__u64 bytes_received;
+	__u32 srtt_us;
+	__u32 total_retrans;
+};
+
+/* Phan pkg_name con lai canh event.flow o EVENT_CLOSE. */
+#define CLOSE_PKG_LEN (PKG_NAME_LEN - sizeof(struct tcp_flow_stats))
+
 /* Dung chung giua BPF program va user-space: giu dung kich thuoc tung field
  * de tranh lech struct layout giua 2 ben khi build bang compiler khac nhau. */
 struct event {
+	__u64 ts_ns;    /* bpf_ktime_get_boot_ns(), user-space doi sang wall-clock */
+	__u64 cgroup_id; /* cgroup v2 cua task (container), = inode thu muc cgroup */
+	__u64 flow_id;  /* socket cookie (hoac FLOW_ID_LOCAL | ...), 0 = khong co */
 	__u32 pid;
 	__u32 uid;
+	__u32 netns;    /* inode cua network namespace cua socket */
 	__u16 family;   /* AF_INET (2) hoac AF_INET6 (10) */
 	__u16 sport;
 	__u16 dport;
-	__u16 pad;      /* khong dung, giu alignment cho union ben duoi */
+	__u16 weight;   /* sampling 1/N luc ghi event: moi event dai dien cho N connect */
+	__u8  kind;     /* EVENT_* */
+	__u8  state;    /* TCP_* cua socket, o EVENT_SNAPSHOT va EVENT_CLOSE */
+	__u8  proto;    /* IPPROTO_TCP, IPPROTO_UDP (--udp) */
+	__u8  dir;      /* DIR_*, sport luon la port local, dport la port dau kia */
+	union {
+		__u32 saddr_v4;
+		__u8  saddr_v6[16];
+	};
+	union {
+		__u32 daddr_v4;
+		__u8  daddr_v6[16];
+	};
+	char comm[TASK_COMM_LEN];
+	union {
+		char pkg_name[PKG_NAME_LEN];
+		struct {                    /* EVENT_CLOSE */
+			char close_pkg[CLOSE_PKG_LEN];  /* pkg luc connect, tu netlog_conn.c */
+			struct tcp_flow_stats flow;
+		};
+	};
+};
+
+/* Record ring buffer cua --batch: n event cung CPU, theo thu tu ghi. Ring
+ * chi chua n event dau (len = offsetof(ev) + n * sizeof(struct event)), nen
+ * user-space phan biet voi record 1 event bang do dai. */
+struct event_batch {
+	__u32 n;
+	__u32 pad;
+	struct event ev[BATCH_MAX];
+};
+
+/* Record ring cua --flows: 1 ket noi TCP luc sang TCP_CLOSE. Gon hon struct
+ * event (khong co pkg), user-space phan biet bang do dai va doi sang event
+ * kind = EVENT_CLOSE. Phan truoc st duoc ghi luc connect (map open_flows). */
+struct flow_rec {
+	__u64 ts_ns;    /* luc connect, doi thanh luc dong khi gui */
+	__u64 cgroup_id;
+	__u64 flow_id;
+	struct tcp_flow_stats st;
+	__u32 pid;
+	__u32 uid;
+	__u32 netns;
+	__u16 family;
+	__u16 sport;
+	__u16 dport;
+	__u16 weight;
+	__u8  dir;
+	__u8  pad[3];
 	union {
 		__u32 saddr_v4;
 		__u8  saddr_v6[16];
@@ -22,7 +113,107 @@ struct event {
 		__u8  daddr_v6[16];
 	};
 	char comm[TASK_COMM_LEN];
+};
+
+/* Record ring cua --dns: 1 ban ghi A/AAAA trong tra loi DNS. name la QNAME
+ * nguyen dang label (byte do dai + chu, ket thuc 0), dai qua thi bi cat;
+ * netlog.c doi sang dang cham. Ngan hon flow_rec de phan biet bang do dai. */
+struct dns_rec {
+	__u64 ts_ns;
+	__u32 ttl;      /* giay, nhu trong goi */
+	__u16 family;   /* AF_INET: 4 byte dau cua addr */
+	__u16 pad;
+	__u8  addr[16];
+	__u8  name[DNS_NAME_LEN];
+};
+
+/* Gia tri duy nhat cua map sample_ctl, user-space cap nhat theo do tre. */
+struct sample_ctl {
+	__u32 rate;     /* 0/1 = giu moi event, N = giu ngau nhien 1/N */
+	__u32 epoch;    /* --heavy: chu ky hien tai cua sketch */
+};
+
+/* Key cua map top_talkers (che do --top): dem so connect theo
+ * (pkg, daddr, dport) ngay trong kernel, khong day event ra user-space.
+ * Moi byte cua key phai duoc zero truoc khi dung vi hash tinh tren ca struct. */
+struct talker_key {
 	char pkg_name[PKG_NAME_LEN];
+	__u8 daddr[16]; /* dau kia, IPv4 nam o 4 byte dau */
+	__u16 dport;    /* port dich vu: dport khi DIR_OUT, port local khi DIR_IN */
+	__u16 family;
+	__u8 dir;
+	__u8 pad[3];
+};
+
+/* O cua map cms (--heavy, per-CPU): epoch khac sample_ctl.epoch la o cua
+ * chu ky truoc, probe coi nhu 0 nen user-space khong phai xoa map. */
+struct cms_cell {
+	__u32 epoch;
+	__u32 count;
+};
+
+/* Record ring cua --heavy: 1 connect cua flow da vuot nguong tren CPU do
+ * trong chu ky, count = uoc luong cua sketch sau connect nay. Uoc luong co
+ * the nhay qua nguong (o chung voi flow khac) nen user-space giu max theo
+ * (flow, cpu, epoch) thay vi cong. epoch = 16 bit thap cua sample_ctl.epoch. */
+struct heavy_rec {
+	struct talker_key key;
+	__u32 count;
+	__u16 cpu;
+	__u16 epoch;
+};
+
+/* Hash cua flow cho sketch, dung chung cho probe va netlog_bench -s: o cua
+ * hang i la (h1 + i * h2) & (CMS_WIDTH - 1), 2 hash du cho moi hang. */
+static inline __u32 cms_mix(__u32 h)
+{
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35;
+	return h ^ h >> 16;
+}
+
+static inline void cms_hash(__u32 uid, const __u32 daddr[4], __u32 port_dir,
+			    __u32 *h1, __u32 *h2)
+{
+	__u32 h = cms_mix(cms_mix(uid) ^ port_dir);
+	int i;
+
+	for (i = 0; i < 4; i++)
+		h = cms_mix(h ^ daddr[i]);
+	*h1 = h;
+	*h2 = cms_mix(h ^ 0x9e3779b9) | 1;
+}
+
+/* Map usage_stats (--usage): byte/packet theo (uid, protocol L4) cua socket,
+ * dem trong cgroup_skb. proto 0 = goi khong gan full socket. */
+struct usage_key {
+	__u32 uid;
+	__u8  proto;    /* IPPROTO_TCP / UDP / ... */
+	__u8  pad[3];
+};
+
+struct usage_val {
+	__u64 rx_bytes;
+	__u64 tx_bytes;
+	__u64 rx_pkts;
+	__u64 tx_pkts;
+};
+
+/* Map dest_stats (--retrans): gui lai va RST theo (uid, daddr, dport), dem
+ * trong tracepoint TCP. Zero ca key truoc khi dien nhu talker_key. */
+struct dest_key {
+	__u8  daddr[16];        /* IPv4 nam o 4 byte dau */
+	__u32 uid;
+	__u16 dport;
+	__u16 family;
+};
+
+struct dest_val {
+	__u64 retrans;          /* tcp_retransmit_skb */
+	__u64 rst_sent;         /* tcp_send_reset */
+	__u64 rst_recv;         /* tcp_receive_reset */
 };
 
 #endif /* __NETLOG_H */
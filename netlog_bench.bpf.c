@@ -0,0 +1,83 @@
+/*
+ * netlog_bench.bpf.c - chay phan than probe (netlog.bpf.h) trong raw_tp de
+ * do bang BPF_PROG_TEST_RUN, khong can tao connect that cho moi lan chay.
+ * Driver: netlog_bench.c.
+ */
+#include "vmlinux.h"
+#include <bpf/bpf_helpers.h>
+#include <bpf/bpf_core_read.h>
+#include <bpf/bpf_tracing.h>
+#include <bpf/bpf_endian.h>
+#include "netlog.h"
+#include "netlog.bpf.h"
+#include "netlog_bench.h"
+
+char LICENSE[] SEC("license") = "Dual BSD/GPL";
+
+/* tgid cua driver: chi bat sk tu connect cua chinh no. */
+const volatile u32 bench_tgid = 0;
+
+/* Con tro struct sock that (0 = IPv4, 1 = IPv6), driver giu socket mo suot
+ * thoi gian do nen doc qua BPF_CORE_READ van hop le. */
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(max_entries, 2);
+	__type(key, u32);
+	__type(value, u64);
+} bench_sk SEC(".maps");
+
+SEC("kprobe/tcp_connect")
+int BPF_KPROBE(bench_capture_sk, struct sock *sk)
+{
+	u32 idx;
+	u16 family = 0;
+	u64 ptr = (u64)sk;
+
+	if (bpf_get_current_pid_tgid() >> 32 != bench_tgid)
+		return 0;
+	BPF_CORE_READ_INTO(&family, sk, __sk_common.skc_family);
+	idx = family == AF_INET6;
+	bpf_map_update_elem(&bench_sk, &idx, &ptr, BPF_ANY);
+	return 0;
+}
+
+/* ctx->args[0] = BENCH_F_*, ctx->args[1] = 0 (IPv4) / 1 (IPv6). */
+SEC("raw_tp")
+int bench_probe(struct bpf_raw_tracepoint_args *ctx)
+{
+	u64 flags = ctx->args[0];
+	u32 idx = ctx->args[1] ? 1 : 0;
+	struct event *ev;
+	u64 *ptr;
+
+	ptr = bpf_map_lookup_elem(&bench_sk, &idx);
+	if (!ptr || !*ptr)
+		return 1;
+
+	if (flags & BENCH_F_BATCH)
+		ev = batch_slot();
+	else
+		ev = get_scratch_event();
+	if (!ev)
+		return 1;
+
+	if (fill_sock(ev, (struct sock *)*ptr, true))
+		return 1;
+	fill_task(ev, flags & BENCH_F_PKG);
+	ev->weight = 1;
+
+	if (flags & BENCH_F_COUNT)
+		count_talker(ev);
+	if (flags & BENCH_F_RINGBUF)
+		submit_event(ctx, ev, false);
+	if (flags & BENCH_F_BATCH)
+		batch_commit(BATCH_MAX, ~0ULL);
+	return 0;
+}
+
+/* Chi phi co dinh cua mot lan BPF_PROG_TEST_RUN, tru ra khoi moi bien the. */
+SEC("raw_tp")
+int bench_empty(struct bpf_raw_tracepoint_args *ctx)
+{
+	return 0;
+}
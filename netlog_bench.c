@@ -0,0 +1,755 @@
+/*
+ * netlog_bench.c - microbenchmark than probe bang BPF_PROG_TEST_RUN.
+ *
+ * Build (giong netlog, xem netlog.c):
+ *   clang -g -O2 -target bpf -D__TARGET_ARCH_arm64 -I. -c netlog_bench.bpf.c -o netlog_bench.bpf.o
+ *   bpftool gen skeleton netlog_bench.bpf.o > netlog_bench.skel.h
+ *   $(CC) -g -O2 -I. netlog_bench.c netlog_pkg.c -lbpf -lelf -lz -lpthread -o netlog_bench
+ * (can ca netlog.skel.h cho -m).
+ *
+ * netlog_bench -m: load netlog.bpf.o voi moi to hop cau hinh .rodata (pkg,
+ * IPv6, loc, --top), bao loi neu co to hop khong load duoc, va in so lenh sau
+ * verifier (xlated) / sau JIT de thay nhanh bi tat da bi cat bo.
+ *
+ * netlog_bench -j N: them bang tranh chap, moi bien the chay dong thoi tren
+ * CPU 0..N-1 (thread ghim CPU, main thread doc ring): reserve/submit tung
+ * event tranh nhau lock va producer_pos cua ring, --batch thi moi CPU chi
+ * cham vao ring 1 lan moi BATCH_MAX event.
+ *
+ * netlog_bench -k [FILE]: do chi phi pkgdb_lookup() (--packages cua netlog)
+ * tren FILE, hoac tren packages.list gia lap nhieu uid neu khong co FILE; khi
+ * do kiem tra them ket qua lookup (shared uid, dong hong, isolated, user phu,
+ * nap lai sau rename) va thoat 1 neu sai.
+ *
+ * netlog_bench -s: sai so cua count-min sketch (--heavy) theo so hang/so o,
+ * tren luong connect gia lap nhieu dich, bao loi neu co flow bi uoc luong
+ * thap hon so that.
+ *
+ * Driver tu connect toi listener loopback (IPv4 va IPv6) de kprobe bat duoc
+ * con tro struct sock that, sau do chay bench_probe N lan cho moi bien the:
+ * co/khong read_pkg_name, IPv4/IPv6, ring buffer/chi dem. raw_tp tren kernel
+ * 5.10 khong nhan "repeat" nen khi do driver tu lap syscall va tru di chi phi
+ * cua bench_empty do cung cach.
+ */
+#define _GNU_SOURCE
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <linux/types.h>
+#include <bpf/libbpf.h>
+#include <bpf/bpf.h>
+#include "netlog.h"
+#include "netlog_bench.h"
+#include "netlog_pkg.h"
+#include "netlog.skel.h"
+#include "netlog_bench.skel.h"
+
+#define BENCH_BATCH 1000   /* < 256 KiB ring / sizeof(struct event) */
+#define PKG_FIXTURE_NR 4000  /* so package trong packages.list gia lap */
+#define CMS_SIM_FLOWS  100000 /* so dich khac nhau cua -s */
+#define CMS_SIM_WIDTH_MAX 8192
+
+static struct {
+	unsigned long iters;
+	int cpu;
+	unsigned int jobs;  /* != 0: -j, so CPU chay dong thoi */
+	bool matrix;
+	bool pkg;
+	const char *pkg_file;
+	bool sketch;
+} env = {
+	.iters = 1000000,
+	.cpu = 0,
+};
+
+static int libbpf_print_fn(enum libbpf_print_level level, const char *fmt, va_list args)
+{
+	return level == LIBBPF_DEBUG ? 0 : vfprintf(stderr, fmt, args);
+}
+
+static __u64 mono_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (__u64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int drop_event(void *ctx, void *data, size_t data_sz)
+{
+	return 0;
+}
+
+/* Listener + client da connect tren loopback; tra ve fd client, giu mo. */
+static int loopback_connect(int family, int *lfd)
+{
+	struct sockaddr_storage ss = {};
+	socklen_t len = family == AF_INET ? sizeof(struct sockaddr_in)
+					  : sizeof(struct sockaddr_in6);
+	int cfd;
+
+	if (family == AF_INET) {
+		struct sockaddr_in *sin = (void *)&ss;
+
+		sin->sin_family = AF_INET;
+		sin->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	} else {
+		struct sockaddr_in6 *sin6 = (void *)&ss;
+
+		sin6->sin6_family = AF_INET6;
+		sin6->sin6_addr = in6addr_loopback;
+	}
+
+	*lfd = socket(family, SOCK_STREAM, 0);
+	if (*lfd < 0 || bind(*lfd, (void *)&ss, len) || listen(*lfd, 1) ||
+	    getsockname(*lfd, (void *)&ss, &len))
+		return -errno;
+
+	cfd = socket(family, SOCK_STREAM, 0);
+	if (cfd < 0)
+		return -errno;
+	if (connect(cfd, (void *)&ss, len)) {
+		close(cfd);
+		return -errno;
+	}
+	return cfd;
+}
+
+/* Tong ns cho env.iters lan chay prog_fd voi args. */
+static int run_prog(int prog_fd, struct ring_buffer *rb, __u64 flags, __u64 v6,
+		    double *ns_per_run)
+{
+	__u64 args[2] = { flags, v6 };
+	LIBBPF_OPTS(bpf_test_run_opts, opts,
+		.ctx_in = args,
+		.ctx_size_in = sizeof(args),
+	);
+	unsigned long done = 0, i, n;
+	__u64 total = 0, t0;
+
+	/* Kernel nao cho raw_tp dung repeat thi de kernel do. */
+	opts.repeat = env.iters;
+	if (!bpf_prog_test_run_opts(prog_fd, &opts) && opts.duration) {
+		*ns_per_run = opts.duration;
+		return opts.retval ? -EINVAL : 0;
+	}
+	opts.repeat = 0;
+
+	while (done < env.iters) {
+		n = env.iters - done < BENCH_BATCH ? env.iters - done : BENCH_BATCH;
+		t0 = mono_ns();
+		for (i = 0; i < n; i++)
+			if (bpf_prog_test_run_opts(prog_fd, &opts))
+				return -errno;
+		total += mono_ns() - t0;
+		if (opts.retval)
+			return -EINVAL;
+		done += n;
+		/* Ngoai vung do: giai phong ring cho batch sau (-j: main thread doc). */
+		if (rb)
+			ring_buffer__consume(rb);
+	}
+	*ns_per_run = (double)total / env.iters;
+	return 0;
+}
+
+struct worker {
+	pthread_t th;
+	int cpu;
+	int prog_fd;
+	__u64 flags;
+	double ns;
+	int err;
+};
+
+static int start;        /* 0 = cho, 1 = chay, -1 = huy */
+static unsigned int workers_left;
+
+static void *worker_fn(void *arg)
+{
+	struct worker *w = arg;
+	cpu_set_t set;
+
+	CPU_ZERO(&set);
+	CPU_SET(w->cpu, &set);
+	w->err = -pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	/* Moi thread ghim CPU xong moi bat dau, de cac CPU chay chong len nhau. */
+	while (!__atomic_load_n(&start, __ATOMIC_ACQUIRE))
+		sched_yield();
+	if (start < 0)
+		w->err = -ECANCELED;
+	if (!w->err)
+		w->err = run_prog(w->prog_fd, NULL, w->flags, 0, &w->ns);
+	__atomic_sub_fetch(&workers_left, 1, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+/* env.jobs thread cung chay prog_fd (IPv4), tra ve ns/lan trung binh. */
+static int run_parallel(int prog_fd, struct ring_buffer *rb, __u64 flags, double *ns)
+{
+	struct worker *w;
+	unsigned int i, started;
+	int err = 0;
+
+	w = calloc(env.jobs, sizeof(*w));
+	if (!w)
+		return -ENOMEM;
+	start = 0;
+	for (started = 0; started < env.jobs; started++) {
+		w[started].cpu = started;
+		w[started].prog_fd = prog_fd;
+		w[started].flags = flags;
+		__atomic_add_fetch(&workers_left, 1, __ATOMIC_RELAXED);
+		if (pthread_create(&w[started].th, NULL, worker_fn, &w[started])) {
+			__atomic_sub_fetch(&workers_left, 1, __ATOMIC_RELAXED);
+			err = -EAGAIN;
+			break;
+		}
+	}
+	__atomic_store_n(&start, err ? -1 : 1, __ATOMIC_RELEASE);
+	while (__atomic_load_n(&workers_left, __ATOMIC_ACQUIRE))
+		ring_buffer__poll(rb, 1);
+
+	*ns = 0;
+	for (i = 0; i < started; i++) {
+		pthread_join(w[i].th, NULL);
+		if (w[i].err && !err)
+			err = w[i].err;
+		*ns += w[i].ns / env.jobs;
+	}
+	ring_buffer__consume(rb);
+	free(w);
+	return err;
+}
+
+/* Ring buffer (tung event) so voi batch, 1 CPU va env.jobs CPU cung luc. */
+static int run_contention(struct netlog_bench_bpf *skel, struct ring_buffer *rb)
+{
+	static const struct { const char *name; __u64 flags; } variants[] = {
+		{ "ringbuf",  BENCH_F_RINGBUF },
+		{ "batch",    BENCH_F_BATCH },
+	};
+	int probe = bpf_program__fd(skel->progs.bench_probe);
+	int empty = bpf_program__fd(skel->progs.bench_empty);
+	double base1, baseN, one, many;
+	unsigned int v;
+	int err;
+
+	err = run_prog(empty, rb, 0, 0, &base1);
+	if (!err)
+		err = run_parallel(empty, rb, 0, &baseN);
+	if (err)
+		return err;
+
+	printf("\ntranh chap ring buffer, IPv4 no-pkg, %u CPU dong thoi\n", env.jobs);
+	printf("%-10s %12s %12s %8s\n", "VARIANT", "NS/RUN 1CPU", "NS/RUN NCPU", "NCPU/1");
+	for (v = 0; v < sizeof(variants) / sizeof(variants[0]); v++) {
+		err = run_prog(probe, rb, variants[v].flags, 0, &one);
+		if (!err)
+			err = run_parallel(probe, rb, variants[v].flags, &many);
+		if (err) {
+			fprintf(stderr, "Loi: -j %s (%d)\n", variants[v].name, err);
+			return err;
+		}
+		one -= base1;
+		many -= baseN;
+		printf("%-10s %12.1f %12.1f %8.2f\n", variants[v].name, one, many,
+		       one > 0 ? many / one : 0);
+	}
+	return 0;
+}
+
+/* Bit cua to hop trong che do -m. */
+#define MX_PKG    (1 << 0)
+#define MX_IPV6   (1 << 1)
+#define MX_FILTER (1 << 2)
+#define MX_TOP    (1 << 3)
+#define MX_HEAVY  (1 << 4)  /* khong di cung MX_TOP */
+#define MX_ALL    32
+
+static int load_variant(unsigned int mx, __u32 *xlated, __u32 *jited)
+{
+	struct bpf_prog_info info = {};
+	__u32 len = sizeof(info);
+	struct netlog_bpf *skel;
+	int err;
+
+	skel = netlog_bpf__open();
+	if (!skel)
+		return -errno;
+
+	skel->rodata->capture_pkg = mx & MX_PKG;
+	skel->rodata->enable_ipv6 = mx & MX_IPV6;
+	if (mx & MX_FILTER) {
+		skel->rodata->filter_uid = 0;
+		skel->rodata->filter_dport = 443;
+	}
+	if (mx & MX_TOP) {
+		skel->rodata->emit_events = false;
+		skel->rodata->count_talkers = true;
+	}
+	if (mx & MX_HEAVY) {
+		skel->rodata->emit_events = false;
+		skel->rodata->heavy_thresh = HEAVY_THRESH_DEFAULT;
+	} else {
+		bpf_map__set_autocreate(skel->maps.cms, false);
+	}
+	/* Chi do ban kprobe, khong can map va program cua perf buffer, --flight,
+	 * --batch, snapshot, --usage, --flows, --retrans, --udp, --inbound. */
+	bpf_program__set_autoload(skel->progs.bpf_prog_tcp_connect_fentry, false);
+	bpf_map__set_autocreate(skel->maps.events_perf, false);
+	bpf_map__set_autocreate(skel->maps.flight_ring, false);
+	bpf_map__set_autocreate(skel->maps.flight_head, false);
+	bpf_map__set_autocreate(skel->maps.batch_stage, false);
+	bpf_map__set_autocreate(skel->maps.batch_ts, false);
+	bpf_program__set_autoload(skel->progs.bpf_prog_batch_flush, false);
+	bpf_program__set_autoload(skel->progs.bpf_iter_tcp, false);
+	bpf_map__set_autocreate(skel->maps.usage_stats, false);
+	bpf_map__set_autocreate(skel->maps.open_flows, false);
+	bpf_program__set_autoload(skel->progs.bpf_prog_tcp_close, false);
+	bpf_program__set_autoload(skel->progs.bpf_prog_tcp_close_btf, false);
+	bpf_map__set_autocreate(skel->maps.dest_stats, false);
+	bpf_map__set_autocreate(skel->maps.udp_seen, false);
+	bpf_program__set_autoload(skel->progs.bpf_prog_tcp_accept, false);
+	bpf_program__set_autoload(skel->progs.bpf_prog_udp_egress, false);
+	bpf_program__set_autoload(skel->progs.bpf_prog_dns_ingress, false);
+	bpf_program__set_autoload(skel->progs.bpf_prog_tcp_retrans, false);
+	bpf_program__set_autoload(skel->progs.bpf_prog_tcp_send_reset, false);
+	bpf_program__set_autoload(skel->progs.bpf_prog_tcp_recv_reset, false);
+	bpf_program__set_autoload(skel->progs.bpf_prog_usage_ingress, false);
+	bpf_program__set_autoload(skel->progs.bpf_prog_usage_egress, false);
+
+	err = netlog_bpf__load(skel);
+	if (!err)
+		err = bpf_prog_get_info_by_fd(bpf_program__fd(skel->progs.bpf_prog_tcp_connect),
+					      &info, &len) ? -errno : 0;
+	*xlated = info.xlated_prog_len / 8;
+	*jited = info.jited_prog_len;
+	netlog_bpf__destroy(skel);
+	return err;
+}
+
+static int run_matrix(void)
+{
+	__u32 xlated[MX_ALL], jited[MX_ALL];
+	unsigned int mx, bad = 0, nr = 0;
+	int err;
+
+	printf("%-4s %-5s %-6s %-4s %-5s %8s %8s\n",
+	       "PKG", "IPV6", "FILTER", "TOP", "HEAVY", "XLATED", "JITED");
+	for (mx = 0; mx < MX_ALL; mx++) {
+		if ((mx & MX_TOP) && (mx & MX_HEAVY))
+			continue;
+		nr++;
+		err = load_variant(mx, &xlated[mx], &jited[mx]);
+		if (err) {
+			printf("to hop %#x KHONG load duoc (%d)\n", mx, err);
+			bad++;
+			continue;
+		}
+		printf("%-4s %-5s %-6s %-4s %-5s %8u %8u\n",
+		       mx & MX_PKG ? "on" : "off", mx & MX_IPV6 ? "on" : "off",
+		       mx & MX_FILTER ? "on" : "off", mx & MX_TOP ? "on" : "off",
+		       mx & MX_HEAVY ? "on" : "off", xlated[mx], jited[mx]);
+	}
+	if (bad)
+		return -EINVAL;
+
+	/* Tat pkg hoac IPv6 phai luon lam probe ngan hon to hop tuong ung. */
+	for (mx = 0; mx < MX_ALL; mx++) {
+		if ((mx & MX_TOP) && (mx & MX_HEAVY))
+			continue;
+		if ((mx & MX_PKG) && xlated[mx & ~MX_PKG] >= xlated[mx]) {
+			printf("tat pkg khong giam lenh o to hop %#x\n", mx);
+			bad++;
+		}
+		if ((mx & MX_IPV6) && xlated[mx & ~MX_IPV6] >= xlated[mx]) {
+			printf("tat IPv6 khong giam lenh o to hop %#x\n", mx);
+			bad++;
+		}
+	}
+	printf("%s: %u to hop load duoc, %u loi giam lenh\n",
+	       bad ? "FAIL" : "OK", nr, bad);
+	return bad ? -EINVAL : 0;
+}
+
+#define PKG_BAD_APPID 19001  /* chi co trong dong hong cua file gia lap */
+
+/* packages.list gia lap: appId 10000.., vai shared uid (app10 dung chung
+ * appId voi app1, dong sau), va dong hong. */
+static int pkg_fixture(char *path, size_t size)
+{
+	FILE *f;
+	int fd, i;
+
+	snprintf(path, size, "/tmp/netlog_bench_pkgXXXXXX");
+	fd = mkstemp(path);
+	if (fd < 0)
+		return -errno;
+	f = fdopen(fd, "w");
+	if (!f) {
+		close(fd);
+		return -errno;
+	}
+	for (i = 0; i < PKG_FIXTURE_NR; i++)
+		fprintf(f, "com.example.app%d %d 0 /data/user/0/com.example.app%d default:targetSdkVersion=33 3003 0 %d\n",
+			i, 10000 + (i % 10 ? i : i / 10), i, i);
+	fprintf(f, "broken-line\n");
+	fprintf(f, " %d 0 /data/user/0/noname default 3003 0 0\n", PKG_BAD_APPID);
+	fprintf(f, "com.bad.noappid x 0 /data/user/0/com.bad.noappid default 3003 0 0\n");
+	return fclose(f) ? -errno : 0;
+}
+
+static int pkg_expect(__u32 uid, const char *want)
+{
+	const char *name = NULL;
+	size_t len = pkgdb_lookup(uid, &name);
+
+	if (!want ? !len : len == strlen(want) && !memcmp(name, want, len))
+		return 0;
+	printf("FAIL: uid %u -> '%.*s', can '%s'\n", uid, (int)len, len ? name : "",
+	       want ? want : "");
+	return 1;
+}
+
+/* Ket qua lookup tren file gia lap, tra ve so lan sai. */
+static int pkg_check(const char *path)
+{
+	char tmp[80];
+	int bad = 0;
+	FILE *f;
+
+	bad += pkg_expect(10002, "com.example.app2");
+	bad += pkg_expect(10001, "com.example.app1");   /* shared: dong dau */
+	bad += pkg_expect(PKG_BAD_APPID, NULL);
+	bad += pkg_expect(0, NULL);
+	bad += pkg_expect(90005, "<isolated>");         /* app zygote/isolated */
+	bad += pkg_expect(10 * 100000 + 99000, "<isolated>");
+	bad += pkg_expect(10 * 100000 + 10002, "com.example.app2");
+
+	/* Thay file bang rename nhu PackageManager, pkgdb_check() phai nap lai. */
+	snprintf(tmp, sizeof(tmp), "%s.new", path);
+	f = fopen(tmp, "w");
+	if (!f) {
+		printf("FAIL: khong tao duoc %s (%d)\n", tmp, -errno);
+		return bad + 1;
+	}
+	fprintf(f, "com.example.renamed 10002 0 /data/user/0/com.example.renamed default 3003 0 0\n");
+	if (fclose(f) || rename(tmp, path)) {
+		printf("FAIL: khong thay duoc %s (%d)\n", path, -errno);
+		unlink(tmp);
+		return bad + 1;
+	}
+	pkgdb_check();
+	bad += pkg_expect(10002, "com.example.renamed");
+	bad += pkg_expect(10001, NULL);
+
+	printf("%s: kiem tra pkgdb_lookup, %d sai\n", bad ? "FAIL" : "OK", bad);
+	return bad;
+}
+
+static int run_pkg_lookup(void)
+{
+	char fixture[64] = "";
+	const char *path = env.pkg_file, *name;
+	unsigned long i, hit = 0;
+	__u32 seed = 1, nr;
+	size_t len = 0;
+	__u64 t0, t1;
+	int err;
+
+	if (!path) {
+		err = pkg_fixture(fixture, sizeof(fixture));
+		if (err) {
+			fprintf(stderr, "Loi: khong tao duoc packages.list gia lap (%d)\n", err);
+			return err;
+		}
+		path = fixture;
+	}
+	err = pkgdb_open(path);
+	if (err) {
+		fprintf(stderr, "Loi: khong doc duoc %s (%d)\n", path, err);
+		goto out;
+	}
+	nr = pkgdb_count();
+
+	/* uid ngau nhien (LCG) o user 0..3, ca uid co va khong co trong file. */
+	t0 = mono_ns();
+	for (i = 0; i < env.iters; i++) {
+		seed = seed * 1103515245 + 12345;
+		len = pkgdb_lookup((seed >> 8) % (4 * 100000), &name);
+		hit += len != 0;
+	}
+	t1 = mono_ns();
+	printf("%s: %u uid, %lu lookup, %.1f ns/lookup, %.1f%% trung\n",
+	       path, nr, env.iters, (double)(t1 - t0) / env.iters,
+	       100.0 * hit / env.iters);
+	if (fixture[0] && pkg_check(fixture))
+		err = -EINVAL;
+	pkgdb_close();
+out:
+	if (fixture[0])
+		unlink(fixture);
+	return err;
+}
+
+/*
+ * Sketch tuyen tinh: o cuoi cung chi phu thuoc so connect cua moi flow, nen
+ * dem chinh xac truoc (phan bo Zipf s = 1 tren CMS_SIM_FLOWS dich, LCG nhu
+ * -k) roi cong vao sketch mot lan cho moi cap (so hang, so o). Nguong =
+ * 0.1% so connect, giong 1 giay tren 1 CPU cua --heavy.
+ */
+static int run_sketch(void)
+{
+	static const __u32 widths[] = { 256, 1024, CMS_WIDTH, CMS_SIM_WIDTH_MAX };
+	static const __u32 depths[] = { 1, 2, CMS_DEPTH };
+	__u32 *exact, *h1, *h2, *cells, seed = 1, thresh, heavy = 0, f, lo, hi, r;
+	unsigned int wi, di, bad = 0;
+	double *cdf, total = 0, u;
+	unsigned long i;
+	int err = 0;
+
+	exact = calloc(CMS_SIM_FLOWS, sizeof(*exact));
+	h1 = calloc(CMS_SIM_FLOWS, sizeof(*h1));
+	h2 = calloc(CMS_SIM_FLOWS, sizeof(*h2));
+	cdf = calloc(CMS_SIM_FLOWS, sizeof(*cdf));
+	cells = calloc(CMS_DEPTH * CMS_SIM_WIDTH_MAX, sizeof(*cells));
+	if (!exact || !h1 || !h2 || !cdf || !cells) {
+		err = -ENOMEM;
+		goto out;
+	}
+
+	/* Moi dich 1 IPv4 khac nhau, 200 uid, port 443 ra ngoai. */
+	for (f = 0; f < CMS_SIM_FLOWS; f++) {
+		__u32 daddr[4] = { htonl(0x0a000000 + f) };
+
+		cms_hash(10000 + f % 200, daddr, 443, &h1[f], &h2[f]);
+		total += 1.0 / (f + 1);
+		cdf[f] = total;
+	}
+	for (i = 0; i < env.iters; i++) {
+		seed = seed * 1103515245 + 12345;
+		u = (double)(seed >> 8) / (1 << 24) * total;
+		for (lo = 0, hi = CMS_SIM_FLOWS - 1; lo < hi; ) {
+			f = (lo + hi) / 2;
+			if (cdf[f] < u)
+				lo = f + 1;
+			else
+				hi = f;
+		}
+		exact[lo]++;
+	}
+	thresh = env.iters / 1000 ? env.iters / 1000 : 1;
+	for (f = 0; f < CMS_SIM_FLOWS; f++)
+		heavy += exact[f] >= thresh;
+
+	printf("%lu connect, %u dich, nguong %u: %u flow lon that\n",
+	       env.iters, CMS_SIM_FLOWS, thresh, heavy);
+	printf("%-5s %-6s %9s %10s %10s %9s %7s\n",
+	       "DEPTH", "WIDTH", "KiB/CPU", "SAI TB", "SAI MAX", "BAO NHAM", "BO SOT");
+	for (di = 0; di < sizeof(depths) / sizeof(depths[0]); di++) {
+		for (wi = 0; wi < sizeof(widths) / sizeof(widths[0]); wi++) {
+			__u32 d = depths[di], w = widths[wi], fp = 0, fn = 0, est, max = 0;
+			double sum = 0;
+			unsigned int nr = 0;
+
+			memset(cells, 0, CMS_DEPTH * CMS_SIM_WIDTH_MAX * sizeof(*cells));
+			for (f = 0; f < CMS_SIM_FLOWS; f++)
+				for (r = 0; exact[f] && r < d; r++)
+					cells[r * w + ((h1[f] + r * h2[f]) & (w - 1))] += exact[f];
+			for (f = 0; f < CMS_SIM_FLOWS; f++) {
+				if (!exact[f])
+					continue;
+				for (est = ~0U, r = 0; r < d; r++)
+					if (cells[r * w + ((h1[f] + r * h2[f]) & (w - 1))] < est)
+						est = cells[r * w + ((h1[f] + r * h2[f]) & (w - 1))];
+				/* Count-min khong bao gio uoc luong thap. */
+				if (est < exact[f]) {
+					bad++;
+					continue;
+				}
+				nr++;
+				sum += est - exact[f];
+				if (est - exact[f] > max)
+					max = est - exact[f];
+				fp += est >= thresh && exact[f] < thresh;
+				fn += est < thresh && exact[f] >= thresh;
+			}
+			printf("%-5u %-6u %9zu %10.1f %10u %9u %7u\n", d, w,
+			       (size_t)d * w * sizeof(struct cms_cell) >> 10,
+			       nr ? sum / nr : 0, max, fp, fn);
+			bad += fn;
+		}
+	}
+	printf("%s: %u flow bi uoc luong thap/bo sot\n", bad ? "FAIL" : "OK", bad);
+	err = bad ? -EINVAL : 0;
+out:
+	free(exact);
+	free(h1);
+	free(h2);
+	free(cdf);
+	free(cells);
+	return err;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Cach dung: %s [-n N] [-c CPU] [-j N] | -m | -k [FILE] | -s\n"
+		"  -n N     so lan chay moi bien the (mac dinh 1000000)\n"
+		"  -c CPU   chay tren CPU nay (mac dinh 0)\n"
+		"  -j N     them bang ringbuf/batch chay dong thoi tren CPU 0..N-1\n"
+		"  -m       load moi to hop .rodata cua netlog, so sanh so lenh\n"
+		"  -k[FILE] do pkgdb_lookup() tren FILE (mac dinh: file gia lap, co kiem tra)\n"
+		"  -s       sai so count-min sketch cua --heavy theo so hang/o (N connect)\n",
+		prog);
+}
+
+int main(int argc, char **argv)
+{
+	static const struct { const char *name; __u64 flags; } variants[] = {
+		{ "pkg + ringbuf",       BENCH_F_PKG | BENCH_F_RINGBUF },
+		{ "pkg + counters",      BENCH_F_PKG | BENCH_F_COUNT },
+		{ "no-pkg + ringbuf",    BENCH_F_RINGBUF },
+		{ "no-pkg + counters",   BENCH_F_COUNT },
+		{ "pkg + batch",         BENCH_F_PKG | BENCH_F_BATCH },
+		{ "no-pkg + batch",      BENCH_F_BATCH },
+	};
+	int lfd[2] = { -1, -1 }, cfd[2] = { -1, -1 };
+	struct netlog_bench_bpf *skel;
+	struct ring_buffer *rb = NULL;
+	double base, ns;
+	cpu_set_t set;
+	unsigned int v;
+	int opt, err, fam;
+
+	while ((opt = getopt(argc, argv, "n:c:j:mk::sh")) != -1) {
+		switch (opt) {
+		case 'n':
+			env.iters = strtoul(optarg, NULL, 0);
+			break;
+		case 'c':
+			env.cpu = atoi(optarg);
+			break;
+		case 'j':
+			env.jobs = strtoul(optarg, NULL, 0);
+			break;
+		case 'm':
+			env.matrix = true;
+			break;
+		case 'k':
+			env.pkg = true;
+			env.pkg_file = optarg;
+			break;
+		case 's':
+			env.sketch = true;
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (!env.iters) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	if (env.pkg)
+		return run_pkg_lookup() ? 1 : 0;
+	if (env.sketch)
+		return run_sketch() ? 1 : 0;
+
+	libbpf_set_print(libbpf_print_fn);
+
+	if (env.matrix)
+		return run_matrix() ? 1 : 0;
+
+	CPU_ZERO(&set);
+	CPU_SET(env.cpu, &set);
+	if (sched_setaffinity(0, sizeof(set), &set))
+		fprintf(stderr, "canh bao: khong ghim duoc CPU %d\n", env.cpu);
+
+	skel = netlog_bench_bpf__open();
+	if (!skel) {
+		fprintf(stderr, "Loi: khong mo duoc BPF skeleton\n");
+		return 1;
+	}
+	skel->rodata->bench_tgid = getpid();
+	/* -j: nhieu CPU ghi cung luc, ring lon de do tranh chap chu khong do drop. */
+	if (env.jobs)
+		bpf_map__set_max_entries(skel->maps.events, 16 << 20);
+
+	err = netlog_bench_bpf__load(skel);
+	if (!err)
+		err = netlog_bench_bpf__attach(skel);
+	if (err) {
+		fprintf(stderr, "Loi: khong load/attach duoc bench (%d)\n", err);
+		goto cleanup;
+	}
+
+	cfd[0] = loopback_connect(AF_INET, &lfd[0]);
+	cfd[1] = loopback_connect(AF_INET6, &lfd[1]);
+	if (cfd[0] < 0 && cfd[1] < 0) {
+		err = cfd[0];
+		fprintf(stderr, "Loi: khong connect duoc loopback (%d)\n", err);
+		goto cleanup;
+	}
+
+	rb = ring_buffer__new(bpf_map__fd(skel->maps.events), drop_event, NULL, NULL);
+	if (!rb) {
+		err = -errno;
+		fprintf(stderr, "Loi: khong tao duoc ring buffer\n");
+		goto cleanup;
+	}
+
+	err = run_prog(bpf_program__fd(skel->progs.bench_empty), rb, 0, 0, &base);
+	if (err) {
+		fprintf(stderr, "Loi: BPF_PROG_TEST_RUN (%d)\n", err);
+		goto cleanup;
+	}
+
+	printf("%lu lan/bien the, CPU %d, chi phi test-run %.1f ns da tru\n",
+	       env.iters, env.cpu, base);
+	printf("%-6s %-20s %10s\n", "FAMILY", "VARIANT", "NS/RUN");
+	for (fam = 0; fam < 2; fam++) {
+		if (cfd[fam] < 0) {
+			printf("%-6s (bo qua: khong connect duoc loopback)\n",
+			       fam ? "IPv6" : "IPv4");
+			continue;
+		}
+		for (v = 0; v < sizeof(variants) / sizeof(variants[0]); v++) {
+			err = run_prog(bpf_program__fd(skel->progs.bench_probe), rb,
+				       variants[v].flags, fam, &ns);
+			if (err) {
+				fprintf(stderr, "Loi: %s %s (%d)\n", fam ? "IPv6" : "IPv4",
+					variants[v].name, err);
+				goto cleanup;
+			}
+			printf("%-6s %-20s %10.1f\n", fam ? "IPv6" : "IPv4",
+			       variants[v].name, ns - base);
+		}
+	}
+	if (env.jobs && cfd[0] >= 0)
+		err = run_contention(skel, rb);
+
+cleanup:
+	ring_buffer__free(rb);
+	for (fam = 0; fam < 2; fam++) {
+		if (cfd[fam] >= 0)
+			close(cfd[fam]);
+		if (lfd[fam] >= 0)
+			close(lfd[fam]);
+	}
+	netlog_bench_bpf__destroy(skel);
+	return err ? 1 : 0;
+}
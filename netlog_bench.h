@@ -0,0 +1,10 @@
+#ifndef __NETLOG_BENCH_H
+#define __NETLOG_BENCH_H
+
+/* Bien the cua bench_probe, truyen qua ctx->args[0]. */
+#define BENCH_F_PKG     (1 << 0)  /* read_pkg_name tu argv */
+#define BENCH_F_RINGBUF (1 << 1)  /* reserve/submit ring buffer */
+#define BENCH_F_COUNT   (1 << 2)  /* cap nhat top_talkers */
+#define BENCH_F_BATCH   (1 << 3)  /* gom BATCH_MAX event/record (--batch) */
+
+#endif /* __NETLOG_BENCH_H */
@@ -0,0 +1,141 @@
+/*
+ * netlog_caps.c - do tinh nang kernel.
+ *
+ * Tracepoint tra qua BTF (typedef btf_trace_<ten>, co tu 5.5) thay vi tracefs:
+ * khong can mount tracefs va khong doc file. Trampoline (fentry) thi BTF co
+ * ham chua du, arm64 truoc 6.0 load duoc nhung khong attach duoc, nen load
+ * program rong va attach that vao tcp_connect trong chot lat.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/bpf.h>
+#include <linux/btf.h>
+#include <bpf/bpf.h>
+#include <bpf/btf.h>
+#include <bpf/libbpf.h>
+#include "netlog_caps.h"
+
+static __u64 mono_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (__u64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static bool probe_batch_ops(void)
+{
+	__u32 keys[1], vals[1], out, cnt = 1;
+	bool ok;
+	int fd;
+
+	fd = bpf_map_create(BPF_MAP_TYPE_HASH, NULL, sizeof(__u32), sizeof(__u32), 1, NULL);
+	if (fd < 0)
+		return false;
+	/* Map rong: kernel co batch thi tra ENOENT, khong co thi EINVAL. */
+	ok = !bpf_map_lookup_batch(fd, NULL, &out, keys, vals, &cnt, NULL) || errno == ENOENT;
+	close(fd);
+	return ok;
+}
+
+static bool probe_fentry(const struct btf *btf)
+{
+	const struct bpf_insn insns[] = {
+		{ .code = BPF_ALU64 | BPF_MOV | BPF_K, .dst_reg = BPF_REG_0, .imm = 0 },
+		{ .code = BPF_JMP | BPF_EXIT },
+	};
+	LIBBPF_OPTS(bpf_prog_load_opts, opts,
+		.expected_attach_type = BPF_TRACE_FENTRY,
+	);
+	int id, prog_fd, link_fd;
+
+	id = btf__find_by_name_kind(btf, "tcp_connect", BTF_KIND_FUNC);
+	if (id <= 0)
+		return false;
+	opts.attach_btf_id = id;
+	prog_fd = bpf_prog_load(BPF_PROG_TYPE_TRACING, "netlog_probe", "GPL", insns,
+				sizeof(insns) / sizeof(insns[0]), &opts);
+	if (prog_fd < 0)
+		return false;
+	link_fd = bpf_raw_tracepoint_open(NULL, prog_fd);
+	close(prog_fd);
+	if (link_fd < 0)
+		return false;
+	close(link_fd);
+	return true;
+}
+
+/* bpf_get_socket_cookie(struct sock *) chi co cho program TRACING (>= 5.12);
+ * libbpf_probe_bpf_helper khong do duoc TRACING nen load fentry that (khong
+ * attach) goi helper voi tham so dau cua tcp_connect. */
+static bool probe_tracing_cookie(const struct btf *btf)
+{
+	const struct bpf_insn insns[] = {
+		{ .code = BPF_LDX | BPF_MEM | BPF_DW, .dst_reg = BPF_REG_1, .src_reg = BPF_REG_1 },
+		{ .code = BPF_JMP | BPF_CALL, .imm = BPF_FUNC_get_socket_cookie },
+		{ .code = BPF_ALU64 | BPF_MOV | BPF_K, .dst_reg = BPF_REG_0, .imm = 0 },
+		{ .code = BPF_JMP | BPF_EXIT },
+	};
+	LIBBPF_OPTS(bpf_prog_load_opts, opts,
+		.expected_attach_type = BPF_TRACE_FENTRY,
+	);
+	int id, prog_fd;
+
+	id = btf__find_by_name_kind(btf, "tcp_connect", BTF_KIND_FUNC);
+	if (id <= 0)
+		return false;
+	opts.attach_btf_id = id;
+	prog_fd = bpf_prog_load(BPF_PROG_TYPE_TRACING, "netlog_probe", "GPL", insns,
+				sizeof(insns) / sizeof(insns[0]), &opts);
+	if (prog_fd < 0)
+		return false;
+	close(prog_fd);
+	return true;
+}
+
+static bool has_tracepoint(const struct btf *btf, const char *name)
+{
+	char tn[64];
+
+	snprintf(tn, sizeof(tn), "btf_trace_%s", name);
+	return btf__find_by_name_kind(btf, tn, BTF_KIND_TYPEDEF) > 0;
+}
+
+void caps_probe(struct caps *c)
+{
+	__u64 t0 = mono_ns();
+	struct btf *btf;
+
+	memset(c, 0, sizeof(*c));
+	c->ringbuf = libbpf_probe_bpf_map_type(BPF_MAP_TYPE_RINGBUF, NULL) > 0;
+	c->perfbuf = libbpf_probe_bpf_map_type(BPF_MAP_TYPE_PERF_EVENT_ARRAY, NULL) > 0;
+	c->batch_ops = probe_batch_ops();
+
+	btf = btf__load_vmlinux_btf();
+	if (btf) {
+		c->btf = true;
+		c->fentry = probe_fentry(btf);
+		c->socket_cookie = probe_tracing_cookie(btf);
+		c->tp_inet_sock_set_state = has_tracepoint(btf, "inet_sock_set_state");
+		c->tp_tcp_retransmit_skb = has_tracepoint(btf, "tcp_retransmit_skb");
+		c->tp_tcp_send_reset = has_tracepoint(btf, "tcp_send_reset");
+		c->tp_tcp_receive_reset = has_tracepoint(btf, "tcp_receive_reset");
+		/* Context cua iterator chi co trong BTF khi kernel co iterator do. */
+		c->iter_tcp = btf__find_by_name_kind(btf, "bpf_iter__tcp", BTF_KIND_STRUCT) > 0;
+		btf__free(btf);
+	}
+	c->probe_ns = mono_ns() - t0;
+}
+
+void caps_log(const struct caps *c)
+{
+	fprintf(stderr,
+		"netlog: kernel (do trong %.1f ms): btf=%d ringbuf=%d perfbuf=%d batch=%d "
+		"cookie=%d fentry=%d iter=%d tp(sock_state=%d retrans=%d rst_out=%d rst_in=%d)\n",
+		c->probe_ns / 1e6, c->btf, c->ringbuf, c->perfbuf, c->batch_ops,
+		c->socket_cookie, c->fentry, c->iter_tcp, c->tp_inet_sock_set_state,
+		c->tp_tcp_retransmit_skb, c->tp_tcp_send_reset, c->tp_tcp_receive_reset);
+}
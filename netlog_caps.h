@@ -0,0 +1,30 @@
+#ifndef __NETLOG_CAPS_H
+#define __NETLOG_CAPS_H
+
+#include <stdbool.h>
+#include <linux/types.h>
+
+/*
+ * Tinh nang kernel do luc khoi dong (libbpf feature probe + BTF cua vmlinux),
+ * netlog.c dua vao day de chon transport (ring buffer / perf buffer), duong
+ * attach (fentry / kprobe) va cach doc map (batch / tung key).
+ */
+struct caps {
+	bool btf;           /* co /sys/kernel/btf/vmlinux */
+	bool ringbuf;       /* BPF_MAP_TYPE_RINGBUF, >= 5.8 */
+	bool perfbuf;       /* BPF_MAP_TYPE_PERF_EVENT_ARRAY */
+	bool batch_ops;     /* BPF_MAP_LOOKUP_BATCH tren hash map, >= 5.6 */
+	bool socket_cookie; /* TRACING goi duoc bpf_get_socket_cookie, >= 5.12 */
+	bool fentry;        /* BPF trampoline attach duoc vao tcp_connect */
+	bool tp_inet_sock_set_state;
+	bool tp_tcp_retransmit_skb;
+	bool tp_tcp_send_reset;
+	bool tp_tcp_receive_reset;
+	bool iter_tcp;      /* bpf_iter tren socket TCP, >= 5.9 */
+	__u64 probe_ns;     /* thoi gian do */
+};
+
+void caps_probe(struct caps *c);
+void caps_log(const struct caps *c);
+
+#endif /* __NETLOG_CAPS_H */
@@ -0,0 +1,256 @@
+/*
+ * netlog_cgroup.c - tim goc cgroup2, doi path -> id (luc khoi dong, cho
+ * --cgroup), mo thu muc de attach cgroup_skb (--usage) va id -> path (cho
+ * bao cao --scopes).
+ *
+ * Android mount cgroup2 o /sys/fs/cgroup (moi) hoac /dev/cg2_bpf (cu), nen
+ * lay tu /proc/self/mounts thay vi co dinh. Id lay bang name_to_handle_at()
+ * (file handle cua kernfs chinh la cgroup id), kernel khong ho tro thi dung
+ * st_ino (bang nhau tren 64-bit).
+ *
+ * Bang id -> path va vung chua chuoi path cap phat mot lan o lan quet dau
+ * (truoc khi khoa bo nho), quet lai chi ghi de len, va duyet cay bang
+ * getdents64 vao buffer tren stack thay vi nftw() (malloc ben trong), nen
+ * cgroup_rescan() trong vong lap chinh khong cap phat (--mem-budget).
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <mntent.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include "netlog_cgroup.h"
+
+#define CGROUP_CACHE_MAX 1024
+#define CGROUP_ARENA     (CGROUP_CACHE_MAX * 64)        /* path trung binh 64 byte */
+#define CGROUP_DEPTH     16
+
+/* getdents64 khong co wrapper tren moi libc. */
+struct linux_dirent64 {
+	__u64 d_ino;
+	__s64 d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+};
+
+struct cg_name {
+	__u64 id;
+	char *path;     /* tu goc cgroup2, "/" la goc */
+};
+
+static struct {
+	char root[PATH_MAX];
+	size_t root_len;
+	struct cg_name *names;
+	unsigned int nr;
+	char *arena;
+	size_t used;
+} cg;
+
+static int cgroup_root(void)
+{
+	struct mntent *m;
+	FILE *f;
+
+	if (cg.root[0])
+		return 0;
+	f = setmntent("/proc/self/mounts", "r");
+	if (!f)
+		return -errno;
+	while ((m = getmntent(f))) {
+		if (!strcmp(m->mnt_type, "cgroup2") && strlen(m->mnt_dir) < sizeof(cg.root)) {
+			strcpy(cg.root, m->mnt_dir);
+			break;
+		}
+	}
+	endmntent(f);
+	if (!cg.root[0])
+		return -ENOENT;
+	cg.root_len = strlen(cg.root);
+	return 0;
+}
+
+static int path_id(const char *path, __u64 *id)
+{
+	struct {
+		struct file_handle fh;
+		__u64 id;
+	} h = { .fh.handle_bytes = sizeof(__u64) };
+	struct stat st;
+	int mount_id;
+
+	if (!name_to_handle_at(AT_FDCWD, path, &h.fh, &mount_id, 0)) {
+		memcpy(id, h.fh.f_handle, sizeof(*id));
+		return 0;
+	}
+	if (stat(path, &st))
+		return -errno;
+	*id = st.st_ino;
+	return 0;
+}
+
+/* path tuyet doi hoac tu goc cgroup2 -> realpath, phai nam duoi goc. */
+static int cgroup_realpath(const char *path, char *real)
+{
+	char full[PATH_MAX];
+	int err;
+
+	err = cgroup_root();
+	if (err)
+		return err;
+	if (strncmp(path, cg.root, cg.root_len) ||
+	    (path[cg.root_len] && path[cg.root_len] != '/')) {
+		if (snprintf(full, sizeof(full), "%s/%s", cg.root, path) >= (int)sizeof(full))
+			return -ENAMETOOLONG;
+		path = full;
+	}
+	if (!realpath(path, real))
+		return -errno;
+	if (strncmp(real, cg.root, cg.root_len))
+		return -EINVAL;
+	return 0;
+}
+
+int cgroup_resolve(const char *path, __u64 *id, __u32 *level)
+{
+	char real[PATH_MAX];
+	const char *p;
+	int err;
+
+	err = cgroup_realpath(path, real);
+	if (err)
+		return err;
+
+	*level = 0;
+	for (p = real + cg.root_len; *p; p++)
+		if (*p == '/' && p[1])
+			(*level)++;
+	return path_id(real, id);
+}
+
+int cgroup_open(const char *path)
+{
+	char real[PATH_MAX];
+	int err, fd;
+
+	err = cgroup_realpath(path ? path : "/", real);
+	if (err)
+		return err;
+	fd = open(real, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	return fd < 0 ? -errno : fd;
+}
+
+/* Them path vao bang, 1 = bang hoac arena da day. */
+static int scan_add(const char *path)
+{
+	const char *rel = path[cg.root_len] ? path + cg.root_len : "/";
+	size_t len = strlen(rel) + 1;
+	struct cg_name *n;
+	__u64 id;
+
+	if (cg.nr == CGROUP_CACHE_MAX || cg.used + len > CGROUP_ARENA)
+		return 1;
+	if (path_id(path, &id))
+		return 0;
+	n = &cg.names[cg.nr++];
+	n->id = id;
+	n->path = memcpy(cg.arena + cg.used, rel, len);
+	cg.used += len;
+	return 0;
+}
+
+/* Duyet thu muc path (do dai len, buffer PATH_MAX dung chung cho ca cay).
+ * Khong theo symlink, khong sang mount khac: chi cay cgroup2. */
+static int scan_dir(char *path, size_t len, dev_t dev, int depth)
+{
+	char buf[1024] __attribute__((aligned(8)));
+	struct linux_dirent64 *d;
+	struct stat st;
+	int fd, ret;
+	long n, off;
+	size_t nlen;
+
+	ret = scan_add(path);
+	if (ret || depth == CGROUP_DEPTH)
+		return ret;
+	fd = open(path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+	if (fd < 0)
+		return 0;
+	while (!ret && (n = syscall(SYS_getdents64, fd, buf, sizeof(buf))) > 0) {
+		for (off = 0; !ret && off < n; off += d->d_reclen) {
+			d = (struct linux_dirent64 *)(buf + off);
+			if (d->d_type != DT_DIR || !strcmp(d->d_name, ".") ||
+			    !strcmp(d->d_name, ".."))
+				continue;
+			nlen = strlen(d->d_name);
+			if (len + 1 + nlen >= PATH_MAX ||
+			    fstatat(fd, d->d_name, &st, AT_SYMLINK_NOFOLLOW) ||
+			    st.st_dev != dev)
+				continue;
+			path[len] = '/';
+			memcpy(path + len + 1, d->d_name, nlen + 1);
+			ret = scan_dir(path, len + 1 + nlen, dev, depth + 1);
+			path[len] = '\0';
+		}
+	}
+	close(fd);
+	return ret;
+}
+
+int cgroup_rescan(void)
+{
+	char path[PATH_MAX];
+	struct stat st;
+	int err;
+
+	err = cgroup_root();
+	if (err)
+		return err;
+	if (!cg.names) {
+		cg.names = calloc(CGROUP_CACHE_MAX, sizeof(*cg.names));
+		cg.arena = malloc(CGROUP_ARENA);
+		if (!cg.names || !cg.arena) {
+			cgroup_free();
+			return -ENOMEM;
+		}
+	}
+	cg.nr = 0;
+	cg.used = 0;
+	if (stat(cg.root, &st))
+		return -errno;
+	strcpy(path, cg.root);
+	scan_dir(path, cg.root_len, st.st_dev, 0);
+	return 0;
+}
+
+size_t cgroup_mem_usage(void)
+{
+	return CGROUP_CACHE_MAX * sizeof(struct cg_name) + CGROUP_ARENA;
+}
+
+const char *cgroup_path(__u64 id)
+{
+	unsigned int i;
+
+	for (i = 0; i < cg.nr; i++)
+		if (cg.names[i].id == id)
+			return cg.names[i].path;
+	return NULL;
+}
+
+void cgroup_free(void)
+{
+	free(cg.names);
+	free(cg.arena);
+	cg.names = NULL;
+	cg.arena = NULL;
+	cg.nr = 0;
+	cg.used = 0;
+}
@@ -0,0 +1,27 @@
+#ifndef __NETLOG_CGROUP_H
+#define __NETLOG_CGROUP_H
+
+#include <stddef.h>
+#include <linux/types.h>
+
+/*
+ * cgroup v2 <-> id cho --cgroup va --scopes. Id la gia tri
+ * bpf_get_current_cgroup_id() tra ve trong probe (kernfs id cua thu muc).
+ */
+
+/* path: tuyet doi trong filesystem, hoac tuong doi voi goc cgroup2 (vd
+ * "/vendor/container1"). level = do sau tinh tu goc (goc = 0). */
+int cgroup_resolve(const char *path, __u64 *id, __u32 *level);
+
+/* fd thu muc cgroup (de attach program cgroup_skb), path NULL = goc. */
+int cgroup_open(const char *path);
+
+/* Duong dan (tu goc cgroup2) cua id, NULL neu chua biet. Goi cgroup_rescan()
+ * khi gap id moi; cache giu den cgroup_free(). Chi lan rescan dau cap phat
+ * (cgroup_mem_usage() byte), cac lan sau dung lai. */
+const char *cgroup_path(__u64 id);
+int cgroup_rescan(void);
+size_t cgroup_mem_usage(void);
+void cgroup_free(void);
+
+#endif /* __NETLOG_CGROUP_H */
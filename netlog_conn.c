@@ -0,0 +1,133 @@
+/*
+ * netlog_conn.c - bang ket noi theo flow id.
+ *
+ * Open addressing, moi key chi nam trong CONN_PROBE slot ke tu vi tri hash:
+ * lookup va insert toi da CONN_PROBE lan so sanh du bang day. Het cho trong
+ * cua so thi bo dong co last_ns cu nhat trong cua so (gan dung LRU). Xoa de
+ * lai tombstone de khong cat day probe cua key khac; insert dung lai duoc.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "netlog_conn.h"
+
+#define CONN_PROBE 16
+#define CONN_TOMB  (~0ULL)
+
+static struct {
+	struct conn *slots;
+	__u32 mask;
+	unsigned int live;
+	__u64 evicted;
+} ct;
+
+static __u32 conn_cap_pow2(unsigned int cap)
+{
+	__u32 n = CONN_PROBE;
+
+	while (n < cap)
+		n <<= 1;
+	return n;
+}
+
+size_t conn_mem_usage(unsigned int cap)
+{
+	return conn_cap_pow2(cap) * sizeof(struct conn);
+}
+
+int conn_init(unsigned int cap)
+{
+	__u32 n = conn_cap_pow2(cap);
+
+	ct.slots = calloc(n, sizeof(*ct.slots));
+	if (!ct.slots)
+		return -ENOMEM;
+	ct.mask = n - 1;
+	return 0;
+}
+
+void conn_free(void)
+{
+	free(ct.slots);
+	memset(&ct, 0, sizeof(ct));
+}
+
+static __u32 conn_hash(__u64 id)
+{
+	/* Cookie cua kernel va id tu sinh deu tang dan: tron ca 64 bit. */
+	id ^= id >> 33;
+	id *= 0xff51afd7ed558ccdULL;
+	id ^= id >> 33;
+	return (__u32)id;
+}
+
+struct conn *conn_get(__u64 flow_id)
+{
+	__u32 i = conn_hash(flow_id), n;
+
+	if (!ct.slots || !flow_id)
+		return NULL;
+	for (n = 0; n < CONN_PROBE; n++, i++) {
+		struct conn *c = &ct.slots[i & ct.mask];
+
+		if (c->flow_id == flow_id)
+			return c;
+		if (!c->flow_id)
+			return NULL;
+	}
+	return NULL;
+}
+
+struct conn *conn_update(const struct event *e)
+{
+	struct conn *c, *free_slot = NULL, *oldest = NULL;
+	__u32 i = conn_hash(e->flow_id), n;
+
+	if (!ct.slots || !e->flow_id)
+		return NULL;
+	for (n = 0; n < CONN_PROBE; n++, i++) {
+		c = &ct.slots[i & ct.mask];
+		if (c->flow_id == e->flow_id) {
+			c->last_ns = e->ts_ns;
+			return c;
+		}
+		if (!c->flow_id || c->flow_id == CONN_TOMB) {
+			if (!free_slot)
+				free_slot = c;
+			if (!c->flow_id)
+				break;
+		} else if (!oldest || c->last_ns < oldest->last_ns) {
+			oldest = c;
+		}
+	}
+
+	c = free_slot;
+	if (!c) {
+		c = oldest;
+		ct.evicted++;
+	} else {
+		ct.live++;
+	}
+	c->flow_id = e->flow_id;
+	c->last_ns = e->ts_ns;
+	/* Ten dai hon cho trong record dong thi cat. */
+	memcpy(c->pkg, e->pkg_name, sizeof(c->pkg) - 1);
+	c->pkg[sizeof(c->pkg) - 1] = '\0';
+	return c;
+}
+
+void conn_del(__u64 flow_id)
+{
+	struct conn *c = conn_get(flow_id);
+
+	if (!c)
+		return;
+	c->flow_id = CONN_TOMB;
+	ct.live--;
+}
+
+void conn_stats(unsigned int *live, __u64 *evicted)
+{
+	*live = ct.live;
+	*evicted = ct.evicted;
+}
@@ -0,0 +1,37 @@
+#ifndef __NETLOG_CONN_H
+#define __NETLOG_CONN_H
+
+#include <stddef.h>
+#include <linux/types.h>
+#include "netlog.h"
+
+#define CONN_TABLE_CAP 16384
+
+/*
+ * Bang ket noi trong bo nho (--flows), key la flow id cua event (socket
+ * cookie): record dong cua ket noi tim lai dong connect bang 1 lan hash,
+ * khong so 5-tuple, de lay phan chi connect moi co (pkg doc tu argv; flow_rec
+ * trong kernel khong co cho). Kich thuoc co dinh, cap phat 1 lan; day thi bo
+ * ket noi lau khong cap nhat.
+ */
+struct conn {
+	__u64 flow_id;      /* 0 = slot trong */
+	__u64 last_ns;
+	char pkg[CLOSE_PKG_LEN];
+};
+
+/* cap: so dong, lam tron len luy thua 2. */
+int conn_init(unsigned int cap);
+void conn_free(void);
+size_t conn_mem_usage(unsigned int cap);
+
+/* Tim dong cua flow_id, NULL neu khong co. */
+struct conn *conn_get(__u64 flow_id);
+/* Them/cap nhat dong theo connect e (bo qua neu flow_id = 0). */
+struct conn *conn_update(const struct event *e);
+void conn_del(__u64 flow_id);
+
+/* So dong dang co va so dong bi bo do bang day. */
+void conn_stats(unsigned int *live, __u64 *evicted);
+
+#endif /* __NETLOG_CONN_H */
@@ -0,0 +1,166 @@
+/*
+ * netlog_dns.c - cache dia chi -> ten cho --dns.
+ *
+ * Open addressing nhu netlog_conn.c: moi dia chi chi nam trong DNS_PROBE slot
+ * ke tu vi tri hash, lookup va insert toi da DNS_PROBE lan so sanh. Khong
+ * xoa: dong het han duoc insert dung lai, het cho thi bo dong sap het han
+ * nhat trong cua so.
+ */
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include "netlog_dns.h"
+
+#define DNS_PROBE       8
+/* TTL 0 hoac rat ngan: app thuong connect ngay sau khi co tra loi. */
+#define DNS_TTL_MIN_SEC 5
+#define NSEC_PER_SEC    1000000000ULL
+
+struct dns_entry {
+	__u64 expire_ns;    /* 0 = slot trong */
+	__u8 addr[16];
+	__u16 family;
+	char name[DNS_NAME_LEN];
+};
+
+static struct {
+	struct dns_entry *slots;
+	__u32 mask;
+	__u64 added;
+	__u64 evicted;
+} dc;
+
+static __u32 dns_cap_pow2(unsigned int cap)
+{
+	__u32 n = DNS_PROBE;
+
+	while (n < cap)
+		n <<= 1;
+	return n;
+}
+
+size_t dns_mem_usage(unsigned int cap)
+{
+	return dns_cap_pow2(cap) * sizeof(struct dns_entry);
+}
+
+int dns_init(unsigned int cap)
+{
+	__u32 n = dns_cap_pow2(cap);
+
+	dc.slots = calloc(n, sizeof(*dc.slots));
+	if (!dc.slots)
+		return -ENOMEM;
+	dc.mask = n - 1;
+	return 0;
+}
+
+void dns_free(void)
+{
+	free(dc.slots);
+	memset(&dc, 0, sizeof(dc));
+}
+
+static size_t addr_len(__u16 family)
+{
+	return family == AF_INET6 ? 16 : 4;
+}
+
+/* FNV-1a tren phan dia chi dung theo family. */
+static __u32 dns_hash(__u16 family, const __u8 *addr)
+{
+	__u32 h = 2166136261u ^ family;
+	size_t i;
+
+	for (i = 0; i < addr_len(family); i++)
+		h = (h ^ addr[i]) * 16777619u;
+	return h;
+}
+
+static bool dns_match(const struct dns_entry *d, __u16 family, const __u8 *addr)
+{
+	return d->expire_ns && d->family == family &&
+	       !memcmp(d->addr, addr, addr_len(family));
+}
+
+/* Label -> dang cham. Chi giu chu, so, '-', '_': ten vao thang text/JSON. */
+static void dns_name(const __u8 *w, char *out)
+{
+	size_t i = 0, o = 0, len;
+
+	while (i < DNS_NAME_LEN && (len = w[i++]) && len <= 63) {
+		if (o)
+			out[o++] = '.';
+		for (; len && i < DNS_NAME_LEN; len--, i++) {
+			char c = w[i];
+
+			out[o++] = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+				   (c >= '0' && c <= '9') || c == '-' || c == '_' ? c : '?';
+		}
+	}
+	/* Moi byte ra toi da 1 ky tu, byte do dai dau tien khong ra gi: con cho
+	 * cho '\0'. */
+	out[o] = '\0';
+}
+
+void dns_add(const struct dns_rec *r)
+{
+	struct dns_entry *d, *free_slot = NULL, *oldest = NULL;
+	__u32 i = dns_hash(r->family, r->addr), n;
+	__u64 ttl = r->ttl < DNS_TTL_MIN_SEC ? DNS_TTL_MIN_SEC : r->ttl;
+
+	if (!dc.slots)
+		return;
+	dc.added++;
+	for (n = 0; n < DNS_PROBE; n++, i++) {
+		d = &dc.slots[i & dc.mask];
+		if (dns_match(d, r->family, r->addr)) {
+			free_slot = d;
+			break;
+		}
+		if (!d->expire_ns || d->expire_ns <= r->ts_ns) {
+			if (!free_slot)
+				free_slot = d;
+			if (!d->expire_ns)
+				break;
+		} else if (!oldest || d->expire_ns < oldest->expire_ns) {
+			oldest = d;
+		}
+	}
+
+	d = free_slot;
+	if (!d) {
+		d = oldest;
+		dc.evicted++;
+	}
+	memset(d, 0, sizeof(*d));
+	d->expire_ns = r->ts_ns + ttl * NSEC_PER_SEC;
+	memcpy(d->addr, r->addr, addr_len(r->family));
+	d->family = r->family;
+	dns_name(r->name, d->name);
+}
+
+const char *dns_lookup(__u16 family, const __u8 *addr, __u64 now_ns)
+{
+	__u32 i = dns_hash(family, addr), n;
+
+	if (!dc.slots)
+		return NULL;
+	for (n = 0; n < DNS_PROBE; n++, i++) {
+		const struct dns_entry *d = &dc.slots[i & dc.mask];
+
+		if (!d->expire_ns)
+			return NULL;
+		if (dns_match(d, family, addr))
+			return d->expire_ns > now_ns && d->name[0] ? d->name : NULL;
+	}
+	return NULL;
+}
+
+void dns_stats(__u64 *added, __u64 *evicted)
+{
+	*added = dc.added;
+	*evicted = dc.evicted;
+}
@@ -0,0 +1,29 @@
+#ifndef __NETLOG_DNS_H
+#define __NETLOG_DNS_H
+
+#include <stddef.h>
+#include <linux/types.h>
+#include "netlog.h"
+
+#define DNS_CACHE_CAP 4096
+
+/*
+ * Cache dia chi -> ten cho --dns, nap tu dns_rec cua probe. Moi dia chi giu
+ * ten cua tra loi moi nhat toi het TTL (tinh theo ts_ns cua event, khong
+ * theo dong ho luc in). Kich thuoc co dinh, cap phat 1 lan.
+ */
+
+/* cap: so dong, lam tron len luy thua 2. */
+int dns_init(unsigned int cap);
+void dns_free(void);
+size_t dns_mem_usage(unsigned int cap);
+
+void dns_add(const struct dns_rec *r);
+/* Ten cua dia chi con trong TTL tai now_ns, NULL neu khong co. Chuoi nam
+ * trong cache, chi dung toi lan dns_add() sau. */
+const char *dns_lookup(__u16 family, const __u8 *addr, __u64 now_ns);
+
+/* So ban ghi da nhan va so dong con han bi bo do cache day. */
+void dns_stats(__u64 *added, __u64 *evicted);
+
+#endif /* __NETLOG_DNS_H */
@@ -0,0 +1,172 @@
+/*
+ * netlog_flight.c - snapshot flight_ring (xem netlog.bpf.h) theo yeu cau.
+ *
+ * Probe van chay trong luc doc nen moi CPU co the ghi them. Slot cua event
+ * thu s (dem tu 0 tren CPU do) la s & mask, va bi event s + slots ghi de tu
+ * luc head cua CPU dat s + slots. Doc h0 = head truoc, h1 = head sau khi
+ * doc ring thi event s con nguyen ven neu h1 - slots < s < h0.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+#include "netlog_flight.h"
+
+struct flight {
+	int ring_fd;
+	int head_fd;
+	__u32 slots;
+	bool batch;
+	unsigned int ncpu;
+	size_t stride;          /* kernel copy gia tri per-CPU, moi CPU lam tron 8 */
+	__u64 *h0, *h1;
+	__u32 *keys;
+	char *vals;             /* slots * ncpu * stride */
+	const struct event **out;
+};
+
+static size_t value_stride(void)
+{
+	return (sizeof(struct event) + 7) & ~(size_t)7;
+}
+
+size_t flight_mem_usage(__u32 slots)
+{
+	size_t ncpu = libbpf_num_possible_cpus();
+
+	return sizeof(struct flight) + 2 * ncpu * sizeof(__u64) +
+	       slots * (sizeof(__u32) + ncpu * (value_stride() + sizeof(struct event *)));
+}
+
+struct flight *flight_open(int ring_fd, int head_fd, __u32 slots, bool batch)
+{
+	struct flight *f;
+	int ncpu = libbpf_num_possible_cpus();
+	__u32 i;
+
+	if (ncpu <= 0) {
+		errno = ncpu ? -ncpu : EINVAL;
+		return NULL;
+	}
+	f = calloc(1, sizeof(*f));
+	if (!f)
+		return NULL;
+	f->ring_fd = ring_fd;
+	f->head_fd = head_fd;
+	f->slots = slots;
+	f->batch = batch;
+	f->ncpu = ncpu;
+	f->stride = value_stride();
+	f->h0 = calloc(ncpu, sizeof(*f->h0));
+	f->h1 = calloc(ncpu, sizeof(*f->h1));
+	f->keys = calloc(slots, sizeof(*f->keys));
+	f->vals = calloc((size_t)slots * ncpu, f->stride);
+	f->out = calloc((size_t)slots * ncpu, sizeof(*f->out));
+	if (!f->h0 || !f->h1 || !f->keys || !f->vals || !f->out) {
+		flight_close(f);
+		errno = ENOMEM;
+		return NULL;
+	}
+	for (i = 0; i < slots; i++)
+		f->keys[i] = i;
+	return f;
+}
+
+void flight_close(struct flight *f)
+{
+	if (!f)
+		return;
+	free(f->h0);
+	free(f->h1);
+	free(f->keys);
+	free(f->vals);
+	free(f->out);
+	free(f);
+}
+
+/* Ca array mot lan: batch thi vai syscall, khong thi moi key mot syscall. */
+static int read_ring(struct flight *f)
+{
+	LIBBPF_OPTS(bpf_map_batch_opts, opts);
+	size_t row = f->ncpu * f->stride;
+	__u32 batch, cnt, total = 0, i;
+	int err;
+
+	if (f->batch) {
+		do {
+			cnt = f->slots - total;
+			err = bpf_map_lookup_batch(f->ring_fd, total ? &batch : NULL, &batch,
+						   f->keys + total, f->vals + total * row,
+						   &cnt, &opts);
+			total += cnt;
+			if (err && errno != ENOENT)
+				return -errno;
+		} while (!err && total < f->slots);
+		return 0;
+	}
+
+	for (i = 0; i < f->slots; i++)
+		if (bpf_map_lookup_elem(f->ring_fd, &i, f->vals + i * row))
+			return -errno;
+	return 0;
+}
+
+static const struct event *slot_event(const struct flight *f, __u64 s, unsigned int cpu)
+{
+	return (const struct event *)
+		(f->vals + ((s & (f->slots - 1)) * f->ncpu + cpu) * f->stride);
+}
+
+/* Event con nguyen dau tien tu con tro doc cua cpu, NULL neu het. */
+static const struct event *run_head(struct flight *f, unsigned int cpu)
+{
+	const struct event *e;
+
+	for (; f->h1[cpu] < f->h0[cpu]; f->h1[cpu]++) {
+		e = slot_event(f, f->h1[cpu], cpu);
+		if (e->ts_ns)
+			return e;
+	}
+	return NULL;
+}
+
+int flight_snapshot(struct flight *f, const struct event ***evs)
+{
+	const struct event *e, *best;
+	unsigned int cpu, bcpu = 0, n = 0;
+	__u32 zero = 0;
+	int err;
+
+	if (bpf_map_lookup_elem(f->head_fd, &zero, f->h0))
+		return -errno;
+	err = read_ring(f);
+	if (err)
+		return err;
+	if (bpf_map_lookup_elem(f->head_fd, &zero, f->h1))
+		return -errno;
+
+	/* h1 thanh con tro doc cua moi CPU, tu slot cu nhat con nguyen ven. */
+	for (cpu = 0; cpu < f->ncpu; cpu++)
+		f->h1[cpu] = f->h1[cpu] >= f->slots ? f->h1[cpu] - f->slots + 1 : 0;
+
+	/* Moi CPU ghi theo thu tu ts nen lo..h0 cua 1 CPU da sap xep: tron
+	 * ncpu day da sap xep thay vi qsort ca snapshot. */
+	for (;;) {
+		best = NULL;
+		for (cpu = 0; cpu < f->ncpu; cpu++) {
+			e = run_head(f, cpu);
+			if (e && (!best || e->ts_ns < best->ts_ns)) {
+				best = e;
+				bcpu = cpu;
+			}
+		}
+		if (!best)
+			break;
+		f->out[n++] = best;
+		f->h1[bcpu]++;
+	}
+	*evs = f->out;
+	return n;
+}
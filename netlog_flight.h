@@ -0,0 +1,30 @@
+#ifndef __NETLOG_FLIGHT_H
+#define __NETLOG_FLIGHT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <linux/types.h>
+#include "netlog.h"
+
+/*
+ * Doc flight recorder (--flight): probe ghi event vao flight_ring (per-CPU,
+ * vong tron) va tang flight_head, user-space khong lam gi cho toi khi duoc
+ * yeu cau dump. Snapshot doc head truoc va sau khi doc ring, bo slot co the
+ * da bi ghi de giua chung, roi tron event cua moi CPU theo ts_ns.
+ */
+struct flight;
+
+/* slots = max_entries cua flight_ring (luy thua 2). batch: kernel co batch
+ * ops cho map (xem netlog_caps.c), khong thi doc tung key. Moi buffer duoc
+ * cap phat o day, snapshot khong malloc. */
+struct flight *flight_open(int ring_fd, int head_fd, __u32 slots, bool batch);
+void flight_close(struct flight *f);
+
+/* Bo nho user-space cua flight_open(), cho --mem-budget. */
+size_t flight_mem_usage(__u32 slots);
+
+/* Tra ve so event, *evs sap xep theo ts_ns tang dan (cu nhat truoc), tro vao
+ * buffer cua f, dung duoc toi lan snapshot sau. < 0 neu loi. */
+int flight_snapshot(struct flight *f, const struct event ***evs);
+
+#endif /* __NETLOG_FLIGHT_H */
@@ -0,0 +1,308 @@
+/*
+ * netlog_pkg.c - uid -> package cho Android, thay cho doc argv trong kernel.
+ *
+ * argv chi la doan cua process (sai voi shared uid, isolated process, hoac
+ * process tu doi ten) va doc no trong kprobe ton chi phi o moi connect. O day
+ * packages.list duoc doc vao buffer, index la hash table open addressing theo
+ * appId (uid % 100000) tro thang vao buffer, lookup O(1) khong copy.
+ *
+ * PackageManager ghi file moi roi rename de, nen theo doi ca thu muc
+ * (IN_CLOSE_WRITE | IN_MOVED_TO dung ten file). Co 2 index (buffer + bang)
+ * cap phat het luc pkgdb_open() voi du cho cho file lon gap PKG_HEADROOM lan:
+ * nap lai dung index dang ranh roi doi cho, khong malloc/mmap trong vong lap
+ * chinh (--mem-budget). File vuot cho du phong hoac loi thi giu index cu.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include "netlog_pkg.h"
+
+#define AID_USER_OFFSET     100000
+#define AID_ISOLATED_START  90000   /* app zygote + isolated: 90000..99999 */
+#define AID_ISOLATED_END    99999
+#define PKG_HEADROOM        2       /* file/so dong duoc lon gap may lan */
+#define PKG_BUF_MIN         (64 * 1024)
+
+struct pkg_entry {
+	__u32 appid;        /* 0 = slot trong (appId 0 la root, khong co trong file) */
+	__u32 len;
+	const char *name;   /* tro vao buf, khong co '\0' */
+};
+
+struct pkg_index {
+	char *buf;
+	size_t cap;
+	struct pkg_entry *slots;
+	__u32 mask;
+	unsigned int count;
+};
+
+static struct {
+	struct pkg_index ix[2];
+	struct pkg_index *cur;  /* NULL = chua mo */
+	char path[PATH_MAX];
+	const char *base;   /* ten file trong path */
+	int ifd;
+} db = { .ifd = -1 };
+
+static __u32 appid_hash(__u32 appid)
+{
+	return appid * 2654435761u;
+}
+
+static struct pkg_entry *index_slot(const struct pkg_index *ix, __u32 appid)
+{
+	__u32 i = appid_hash(appid) & ix->mask;
+
+	while (ix->slots[i].appid && ix->slots[i].appid != appid)
+		i = (i + 1) & ix->mask;
+	return &ix->slots[i];
+}
+
+static void index_free(struct pkg_index *ix)
+{
+	free(ix->buf);
+	free(ix->slots);
+	memset(ix, 0, sizeof(*ix));
+}
+
+/* Bang du cho lines dong (he so tai <= 1/2). */
+static __u32 index_slots(unsigned int lines)
+{
+	__u32 slots;
+
+	for (slots = 16; slots < 2 * (lines + 1); slots <<= 1)
+		;
+	return slots;
+}
+
+static unsigned int count_lines(const char *p, const char *end)
+{
+	unsigned int lines = 0;
+
+	for (; p < end; p++)
+		lines += *p == '\n';
+	return lines;
+}
+
+/* Doc ca file vao buf (toi da cap), tra ve do dai hoac < 0. */
+static ssize_t read_file(const char *path, char *buf, size_t cap)
+{
+	size_t len = 0;
+	ssize_t n;
+	char c;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+	while (len < cap && (n = read(fd, buf + len, cap - len)) != 0) {
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			n = -errno;
+			close(fd);
+			return n;
+		}
+		len += n;
+	}
+	/* Con du lieu sau cap: file da lon hon cho du phong. */
+	n = len == cap && read(fd, &c, 1) > 0 ? -EFBIG : (ssize_t)len;
+	close(fd);
+	return n ? n : -EINVAL;
+}
+
+/* Parse tung dong "<pkg> <appId> ..." cua file vao ix (da cap phat), bo qua
+ * dong hong. */
+static int index_build(struct pkg_index *ix, const char *path)
+{
+	const char *p, *end, *nl, *sp;
+	ssize_t len;
+
+	len = read_file(path, ix->buf, ix->cap);
+	if (len < 0)
+		return len;
+	end = ix->buf + len;
+	if (index_slots(count_lines(ix->buf, end)) > ix->mask + 1)
+		return -E2BIG;
+	memset(ix->slots, 0, (ix->mask + 1) * sizeof(*ix->slots));
+	ix->count = 0;
+
+	for (p = ix->buf; p < end; p = nl + 1) {
+		struct pkg_entry *e;
+		__u32 appid = 0;
+		const char *q;
+
+		nl = memchr(p, '\n', end - p);
+		if (!nl)
+			nl = end;
+		sp = memchr(p, ' ', nl - p);
+		if (!sp || sp == p)
+			continue;
+		for (q = sp + 1; q < nl && *q >= '0' && *q <= '9'; q++)
+			appid = appid * 10 + (*q - '0');
+		if (!appid || q == sp + 1)
+			continue;
+
+		/* Shared uid: giu package dau tien trong file. */
+		e = index_slot(ix, appid);
+		if (e->appid)
+			continue;
+		e->appid = appid;
+		e->name = p;
+		e->len = sp - p;
+		ix->count++;
+	}
+	return 0;
+}
+
+/* Nap vao index dang ranh, thanh cong thi doi cho. */
+static int pkgdb_load(void)
+{
+	struct pkg_index *ix = db.cur == &db.ix[0] ? &db.ix[1] : &db.ix[0];
+	int err;
+
+	err = index_build(ix, db.path);
+	if (err)
+		return err;
+	db.cur = ix;
+	return 0;
+}
+
+/* Cap phat ca 2 index theo kich thuoc hien tai cua file nhan PKG_HEADROOM. */
+static int pkgdb_alloc(void)
+{
+	size_t cap = PKG_BUF_MIN;
+	unsigned int lines;
+	struct stat st;
+	__u32 slots;
+	ssize_t len;
+	int i;
+
+	if (stat(db.path, &st))
+		return -errno;
+	if ((size_t)st.st_size * PKG_HEADROOM > cap)
+		cap = st.st_size * PKG_HEADROOM;
+	for (i = 0; i < 2; i++) {
+		db.ix[i].buf = malloc(cap);
+		if (!db.ix[i].buf)
+			return -ENOMEM;
+		db.ix[i].cap = cap;
+	}
+	/* So dong lay tu noi dung that, doc tam vao buffer thu 2. */
+	len = read_file(db.path, db.ix[1].buf, cap);
+	if (len < 0)
+		return len;
+	lines = count_lines(db.ix[1].buf, db.ix[1].buf + len);
+	slots = index_slots(PKG_HEADROOM * lines);
+	for (i = 0; i < 2; i++) {
+		db.ix[i].slots = calloc(slots, sizeof(*db.ix[i].slots));
+		if (!db.ix[i].slots)
+			return -ENOMEM;
+		db.ix[i].mask = slots - 1;
+	}
+	return 0;
+}
+
+size_t pkgdb_mem_usage(void)
+{
+	if (!db.cur)
+		return 0;
+	return 2 * (db.ix[0].cap + (db.ix[0].mask + 1) * sizeof(struct pkg_entry));
+}
+
+int pkgdb_open(const char *path)
+{
+	char dir[PATH_MAX];
+	int err;
+
+	if (strlen(path) >= sizeof(db.path))
+		return -ENAMETOOLONG;
+	strcpy(db.path, path);
+	db.base = strrchr(db.path, '/');
+	db.base = db.base ? db.base + 1 : db.path;
+
+	err = pkgdb_alloc();
+	if (!err)
+		err = pkgdb_load();
+	if (err) {
+		pkgdb_close();
+		return err;
+	}
+
+	strcpy(dir, db.path);
+	db.ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (db.ifd < 0 ||
+	    inotify_add_watch(db.ifd, dirname(dir), IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+		fprintf(stderr, "netlog: khong theo doi duoc %s (%d), se khong nap lai\n",
+			db.path, -errno);
+	return 0;
+}
+
+void pkgdb_close(void)
+{
+	if (db.ifd >= 0)
+		close(db.ifd);
+	db.ifd = -1;
+	index_free(&db.ix[0]);
+	index_free(&db.ix[1]);
+	db.cur = NULL;
+}
+
+void pkgdb_check(void)
+{
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	const struct inotify_event *ev;
+	int changed = 0, err;
+	ssize_t n;
+	char *p;
+
+	if (db.ifd < 0)
+		return;
+	while ((n = read(db.ifd, buf, sizeof(buf))) > 0) {
+		for (p = buf; p < buf + n; p += sizeof(*ev) + ev->len) {
+			ev = (const struct inotify_event *)p;
+			if (ev->len && !strcmp(ev->name, db.base))
+				changed = 1;
+		}
+	}
+	if (!changed)
+		return;
+
+	err = pkgdb_load();
+	if (err)
+		fprintf(stderr, "netlog: nap lai %s loi (%d), giu ban cu\n", db.path, err);
+	else
+		fprintf(stderr, "netlog: nap lai %s, %u uid\n", db.path, db.cur->count);
+}
+
+size_t pkgdb_lookup(__u32 uid, const char **name)
+{
+	static const char isolated[] = "<isolated>";
+	__u32 appid = uid % AID_USER_OFFSET;
+	const struct pkg_entry *e;
+
+	if (!db.cur || !appid)
+		return 0;
+	if (appid >= AID_ISOLATED_START && appid <= AID_ISOLATED_END) {
+		*name = isolated;
+		return sizeof(isolated) - 1;
+	}
+	e = index_slot(db.cur, appid);
+	if (!e->appid)
+		return 0;
+	*name = e->name;
+	return e->len;
+}
+
+unsigned int pkgdb_count(void)
+{
+	return db.cur ? db.cur->count : 0;
+}
@@ -0,0 +1,30 @@
+#ifndef __NETLOG_PKG_H
+#define __NETLOG_PKG_H
+
+#include <stddef.h>
+#include <linux/types.h>
+
+#define PACKAGES_LIST_DEFAULT "/data/system/packages.list"
+
+/*
+ * Tra uid -> package tu file dinh dang packages.list cua Android
+ * ("<pkg> <appId> <debuggable> <dataDir> ..."). File duoc doc vao buffer cap
+ * phat luc pkgdb_open(), index tro thang vao buffer, va duoc nap lai (khong
+ * cap phat) khi inotify bao file thay doi.
+ */
+int pkgdb_open(const char *path);
+void pkgdb_close(void);
+
+/* Bo nho cua pkgdb_open() (2 index), cho --mem-budget. */
+size_t pkgdb_mem_usage(void);
+
+/* Tra ve do dai ten (khong co '\0') va *name, 0 neu khong biet uid. */
+size_t pkgdb_lookup(__u32 uid, const char **name);
+
+/* Goi dinh ky trong vong lap chinh: doc inotify (khong chan), nap lai neu can. */
+void pkgdb_check(void);
+
+/* So uid trong index hien tai. */
+unsigned int pkgdb_count(void);
+
+#endif /* __NETLOG_PKG_H */
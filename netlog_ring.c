@@ -0,0 +1,392 @@
+/*
+ * netlog_ring.c - doc ring buffer BPF truc tiep tu trang mmap.
+ *
+ * Bo tri mmap giong libbpf: trang consumer (RW) o offset 0, trang producer
+ * va vung data (RO) o offset page_size, vung data duoc kernel map 2 lan lien
+ * nhau nen record vat qua cuoi ring van la mot doan lien tuc. Record da commit
+ * nam sat nhau nen ca batch thuong chi la 1 iovec; record bi discard cat batch
+ * thanh nhieu iovec.
+ *
+ * Khong dung vmsplice(): trang trong pipe van tro vao ring, producer ghi de
+ * ngay khi consumer_pos duoc day, nguoi doc pipe se thay data moi.
+ *
+ * Che do io_uring dung chinh vung ring lam buffer: kernel khong cho dang ky
+ * (IORING_REGISTER_BUFFERS) vung mmap cua map BPF vi no la file mapping, nen
+ * chi dang ky fd output, con iovec van tro thang vao ring nhu writev().
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <linux/bpf.h>
+#include <bpf/bpf.h>
+#include "netlog_ring.h"
+#include "netlog_uring.h"
+
+#define RAW_IOV_MAX   1024  /* UIO_MAXIOV */
+#define RAW_ASYNC_IOV 128
+#define RAW_BUSY_WAIT_MS 1  /* record dau dang duoc producer dien */
+
+struct raw_batch {
+	unsigned long end;  /* consumer_pos khi batch nay (va cac batch truoc) xong */
+	__u64 off;          /* offset trong file (chi khi seekable) */
+	__u64 t0;
+	bool done;
+	int first, cnt;     /* iov[first..cnt) chua ghi (sau partial write) */
+	struct iovec iov[RAW_ASYNC_IOV];
+};
+
+struct raw_ring {
+	int map_fd;
+	size_t page;
+	__u64 mask;
+	unsigned long *consumer_pos;
+	unsigned long *producer_pos;
+	__u8 *data;
+	struct iovec iov[RAW_IOV_MAX];
+	struct raw_ring_stats stats;
+	/* io_uring: batch[head..tail) da gui, theo thu tu trong ring. */
+	struct uring *u;
+	bool seekable;
+	__u64 file_off;
+	unsigned long sent;
+	unsigned int head, tail;
+	struct raw_batch batch[RAW_ASYNC_SLOTS];
+};
+
+struct raw_ring *raw_ring_open(int map_fd)
+{
+	struct bpf_map_info info = {};
+	__u32 len = sizeof(info);
+	struct raw_ring *r;
+	void *p;
+
+	if (bpf_map_get_info_by_fd(map_fd, &info, &len))
+		return NULL;
+	if (info.type != BPF_MAP_TYPE_RINGBUF) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	r = calloc(1, sizeof(*r));
+	if (!r)
+		return NULL;
+	r->map_fd = map_fd;
+	r->page = sysconf(_SC_PAGESIZE);
+	r->mask = info.max_entries - 1;
+
+	p = mmap(NULL, r->page, PROT_READ | PROT_WRITE, MAP_SHARED, map_fd, 0);
+	if (p == MAP_FAILED)
+		goto err;
+	r->consumer_pos = p;
+
+	p = mmap(NULL, r->page + 2 * (size_t)info.max_entries, PROT_READ, MAP_SHARED,
+		 map_fd, r->page);
+	if (p == MAP_FAILED) {
+		munmap(r->consumer_pos, r->page);
+		goto err;
+	}
+	r->producer_pos = p;
+	r->data = (__u8 *)p + r->page;
+	return r;
+
+err:
+	free(r);
+	return NULL;
+}
+
+void raw_ring_close(struct raw_ring *r)
+{
+	if (!r)
+		return;
+	uring_close(r->u);
+	munmap(r->consumer_pos, r->page);
+	munmap(r->producer_pos, r->page + 2 * (r->mask + 1));
+	free(r);
+}
+
+/* writev het iov, tiep tuc sau partial write (fd chan hoac bi signal). */
+static ssize_t writev_all(int fd, struct iovec *iov, int cnt, struct raw_ring_stats *st)
+{
+	ssize_t total = 0, n;
+
+	while (cnt) {
+		n = writev(fd, iov, cnt);
+		st->writes++;
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		total += n;
+		while (cnt && (size_t)n >= iov->iov_len) {
+			n -= iov->iov_len;
+			iov++;
+			cnt--;
+		}
+		if (cnt) {
+			iov->iov_base = (char *)iov->iov_base + n;
+			iov->iov_len -= n;
+		}
+	}
+	return total;
+}
+
+/*
+ * Gom record da commit tu from thanh iovec (toi da max), tra ve pos sau record
+ * cuoi da gom. Tinh dia chi tu from (khong mask tung record): qua cuoi ring thi
+ * roi vao ban map thu 2, record van lien tuc voi record truoc.
+ */
+static unsigned long raw_collect(struct raw_ring *r, unsigned long from, unsigned long prod,
+				 struct iovec *iov, int max, int *cnt)
+{
+	__u8 *base = r->data + (from & r->mask);
+	struct iovec *v = NULL;
+	unsigned long pos;
+
+	*cnt = 0;
+	for (pos = from; pos < prod; ) {
+		__u8 *hdr = base + (pos - from);
+		__u32 len = __atomic_load_n((__u32 *)hdr, __ATOMIC_ACQUIRE);
+		__u32 rec;
+
+		if (len & BPF_RINGBUF_BUSY_BIT)
+			break;  /* producer chua commit, record sau phai cho */
+		rec = ((len & ~BPF_RINGBUF_DISCARD_BIT) + BPF_RINGBUF_HDR_SZ + 7) & ~7U;
+
+		if (len & BPF_RINGBUF_DISCARD_BIT) {
+			r->stats.discarded++;
+			v = NULL;   /* record commit tiep theo mo iovec moi */
+		} else if (v) {
+			v->iov_len += rec;
+			r->stats.records++;
+		} else {
+			if (*cnt == max)
+				break;
+			v = &iov[(*cnt)++];
+			v->iov_base = hdr;
+			v->iov_len = rec;
+			r->stats.records++;
+		}
+		pos += rec;
+	}
+	return pos;
+}
+
+ssize_t raw_ring_flush(struct raw_ring *r, int out_fd)
+{
+	unsigned long cons = *r->consumer_pos, prod, pos;
+	ssize_t n = 0;
+	int cnt;
+
+	prod = __atomic_load_n(r->producer_pos, __ATOMIC_ACQUIRE);
+	pos = raw_collect(r, cons, prod, r->iov, RAW_IOV_MAX, &cnt);
+	if (cnt) {
+		n = writev_all(out_fd, r->iov, cnt, &r->stats);
+		if (n < 0)
+			return n;
+		r->stats.bytes += n;
+	}
+	/* Chi tra cho cho producer sau khi data da ra khoi ring. */
+	if (pos != cons)
+		__atomic_store_n(r->consumer_pos, pos, __ATOMIC_RELEASE);
+	return n;
+}
+
+static __u64 mono_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (__u64)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+int raw_ring_uring_init(struct raw_ring *r, int out_fd)
+{
+	struct stat st;
+
+	r->u = uring_open(RAW_ASYNC_SLOTS);
+	if (!r->u)
+		return -errno;
+	uring_register_file(r->u, out_fd);
+	/* File thuong: moi batch co offset rieng nen ghi song song van dung thu tu. */
+	r->seekable = !fstat(out_fd, &st) && S_ISREG(st.st_mode);
+	if (r->seekable)
+		r->file_off = lseek(out_fd, 0, SEEK_CUR);
+	r->sent = *r->consumer_pos;
+	r->stats.uring = true;
+	return 0;
+}
+
+static int raw_batch_prep(struct raw_ring *r, struct raw_batch *b)
+{
+	r->stats.writes++;
+	return uring_prep_writev(r->u, b->iov + b->first, b->cnt - b->first,
+				 r->seekable ? b->off : (__u64)-1, b - r->batch);
+}
+
+/* Bo n byte da ghi khoi dau batch, true neu con phan chua ghi (partial write). */
+static bool raw_batch_advance(struct raw_batch *b, size_t n)
+{
+	while (b->first < b->cnt && n >= b->iov[b->first].iov_len)
+		n -= b->iov[b->first++].iov_len;
+	if (b->first == b->cnt)
+		return false;
+	b->iov[b->first].iov_base = (char *)b->iov[b->first].iov_base + n;
+	b->iov[b->first].iov_len -= n;
+	return true;
+}
+
+/* Record tai pos da commit (hoac discard), tuc raw_collect() di qua duoc. */
+static bool raw_committed(const struct raw_ring *r, unsigned long pos)
+{
+	__u32 len;
+
+	if (pos >= __atomic_load_n(r->producer_pos, __ATOMIC_ACQUIRE))
+		return false;
+	len = __atomic_load_n((__u32 *)(r->data + (pos & r->mask)), __ATOMIC_ACQUIRE);
+	return !(len & BPF_RINGBUF_BUSY_BIT);
+}
+
+static bool raw_can_send(const struct raw_ring *r)
+{
+	return raw_committed(r, r->sent) &&
+	       r->tail - r->head < RAW_ASYNC_SLOTS &&
+	       (r->seekable || r->head == r->tail);
+}
+
+int raw_ring_async(struct raw_ring *r)
+{
+	unsigned long cons = *r->consumer_pos, prod;
+	__u64 user_data, now = mono_us();
+	struct raw_batch *b;
+	int res, err, i;
+
+	while (uring_reap(r->u, &user_data, &res)) {
+		b = &r->batch[user_data];
+		if (res < 0)
+			return res;
+		/* Batch luon khac rong: ghi 0 byte thi gui lai chi lap mai. */
+		if (!res)
+			return -EIO;
+		r->stats.bytes += res;
+		if (raw_batch_advance(b, res)) {
+			b->off += res;
+			err = raw_batch_prep(r, b);
+			if (err)
+				return err;
+			continue;
+		}
+		b->done = true;
+		for (i = 0; i < RAW_LAT_BUCKETS - 1 && (now - b->t0) >> (i + 1); i++)
+			;
+		r->stats.lat_hist[i]++;
+	}
+
+	prod = __atomic_load_n(r->producer_pos, __ATOMIC_ACQUIRE);
+	while (raw_can_send(r)) {
+		unsigned long end;
+		__u64 len = 0;
+
+		b = &r->batch[r->tail % RAW_ASYNC_SLOTS];
+		end = raw_collect(r, r->sent, prod, b->iov, RAW_ASYNC_IOV, &b->cnt);
+		if (end == r->sent)
+			break;  /* record dau chua commit */
+		for (i = 0; i < b->cnt; i++)
+			len += b->iov[i].iov_len;
+		b->end = end;
+		b->off = r->file_off;
+		b->t0 = now;
+		b->first = 0;
+		b->done = !b->cnt;  /* toan record discard: khong can ghi */
+		if (b->cnt) {
+			r->stats.depth_hist[r->tail - r->head]++;
+			err = raw_batch_prep(r, b);
+			if (err)
+				return err;
+		}
+		r->file_off += len;
+		r->sent = end;
+		r->tail++;
+	}
+	err = uring_submit(r->u, 0);
+	if (err < 0)
+		return err;
+
+	/* Tra cho cho producer theo thu tu: batch sau xong truoc van phai cho. */
+	while (r->head != r->tail && r->batch[r->head % RAW_ASYNC_SLOTS].done)
+		cons = r->batch[r->head++ % RAW_ASYNC_SLOTS].end;
+	if (cons != *r->consumer_pos)
+		__atomic_store_n(r->consumer_pos, cons, __ATOMIC_RELEASE);
+	return 0;
+}
+
+int raw_ring_async_drain(struct raw_ring *r)
+{
+	unsigned long stop = __atomic_load_n(r->producer_pos, __ATOMIC_ACQUIRE);
+	int err;
+
+	for (;;) {
+		err = raw_ring_async(r);
+		if (err)
+			return err;
+		if (*r->consumer_pos >= stop)
+			return 0;
+		if (r->head != r->tail) {
+			err = uring_submit(r->u, 1);
+			if (err < 0 && err != -EINTR)
+				return err;
+		}
+	}
+}
+
+int raw_ring_wait(struct raw_ring *r, int timeout_ms)
+{
+	struct pollfd pfd = { .fd = r->map_fd, .events = POLLIN };
+	unsigned long pos;
+	int n;
+
+	/* Dang co batch bay thi consumer_pos tut sau producer, poll map fd luon
+	 * san sang: cho CQE thay vao do. */
+	if (r->u) {
+		if (raw_can_send(r))
+			return 1;
+		if (r->head != r->tail)
+			pfd.fd = uring_fd(r->u);
+		pos = r->sent;
+	} else {
+		pos = *r->consumer_pos;
+		if (raw_committed(r, pos))
+			return 1;
+	}
+	/* Record dau con BUSY: kernel van bao map fd san sang vi producer_pos !=
+	 * consumer_pos nen poll tra ve ngay. Producer dang giua reserve va
+	 * submit, ngu ngan roi thu lai thay vi quay vong. */
+	if (pfd.fd == r->map_fd && pos != __atomic_load_n(r->producer_pos, __ATOMIC_ACQUIRE)) {
+		n = poll(NULL, 0, timeout_ms < RAW_BUSY_WAIT_MS ? timeout_ms : RAW_BUSY_WAIT_MS);
+		return n < 0 ? -errno : 0;
+	}
+	n = poll(&pfd, 1, timeout_ms);
+	return n < 0 ? -errno : n;
+}
+
+__u64 raw_ring_avail(const struct raw_ring *r)
+{
+	return __atomic_load_n(r->producer_pos, __ATOMIC_ACQUIRE) -
+	       __atomic_load_n(r->consumer_pos, __ATOMIC_ACQUIRE);
+}
+
+__u64 raw_ring_size(const struct raw_ring *r)
+{
+	return r->mask + 1;
+}
+
+const struct raw_ring_stats *raw_ring_stats(const struct raw_ring *r)
+{
+	return &r->stats;
+}
@@ -0,0 +1,59 @@
+#ifndef __NETLOG_RING_H
+#define __NETLOG_RING_H
+
+#include <sys/types.h>
+#include <linux/types.h>
+
+/*
+ * Consumer rieng cho map BPF_MAP_TYPE_RINGBUF, thay ring_buffer__poll() khi
+ * chi can chuyen record ra fd: writev() tro thang vao vung data da mmap, chi
+ * day consumer_pos sau khi ghi xong, nen user-space khong copy byte nao.
+ *
+ * Dinh dang ghi ra (--raw): chuoi record nguyen ban cua ring buffer, moi
+ * record = __u32 len, __u32 (bo qua), len byte data, pad toi boi cua 8.
+ * Record bi discard khong duoc ghi.
+ */
+struct raw_ring;
+
+#define RAW_ASYNC_SLOTS 8    /* so batch io_uring dang bay toi da */
+#define RAW_LAT_BUCKETS 20   /* log2(us): [0] < 2 us, ..., [19] >= 2^19 us */
+
+struct raw_ring_stats {
+	__u64 records;
+	__u64 discarded;
+	__u64 bytes;        /* byte da ghi ra fd, tinh ca header record */
+	__u64 writes;       /* so lan goi writev / so SQE */
+	bool uring;
+	__u64 lat_hist[RAW_LAT_BUCKETS];    /* submit -> CQE */
+	__u64 depth_hist[RAW_ASYNC_SLOTS];  /* so batch dang bay luc submit them */
+};
+
+struct raw_ring *raw_ring_open(int map_fd);
+void raw_ring_close(struct raw_ring *r);
+
+/* Cho toi khi co viec (record da commit, hoac CQE khi dung io_uring), > 0
+ * neu co, 0 neu het gio hoac record dau van dang duoc producer dien. */
+int raw_ring_wait(struct raw_ring *r, int timeout_ms);
+
+/* Ghi moi record da commit ra out_fd. Tra ve so byte ghi, < 0 neu loi. */
+ssize_t raw_ring_flush(struct raw_ring *r, int out_fd);
+
+/*
+ * Ghi bat dong bo qua io_uring: moi batch la 1 SQE writev tro vao ring,
+ * consumer_pos duoc day theo thu tu khi CQE ve, thread khong bao gio cho ghi.
+ * File thuong thi nhieu batch bay cung luc (offset tuong minh), pipe/socket
+ * thi 1 batch. raw_ring_uring_init() < 0: kernel khong cho, dung raw_ring_flush().
+ */
+int raw_ring_uring_init(struct raw_ring *r, int out_fd);
+/* Nhan CQE, day consumer_pos, gui batch moi; khong chan. */
+int raw_ring_async(struct raw_ring *r);
+/* Luc thoat: cho toi khi moi record co truoc luc goi da ghi xong. */
+int raw_ring_async_drain(struct raw_ring *r);
+
+/* Byte dang cho doc / kich thuoc vung data, cho sampler. */
+__u64 raw_ring_avail(const struct raw_ring *r);
+__u64 raw_ring_size(const struct raw_ring *r);
+
+const struct raw_ring_stats *raw_ring_stats(const struct raw_ring *r);
+
+#endif /* __NETLOG_RING_H */
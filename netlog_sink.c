@@ -0,0 +1,549 @@
+/*
+ * netlog_sink.c - fan-out event toi nhieu output (stdout, file, unix socket).
+ *
+ * Moi sink co hang doi rieng (con tro toi message da format) va thread ghi
+ * rieng, nen sink cham (vd agent doc socket khong kip) chi lam day hang doi
+ * cua chinh no; consumer ring buffer chi bi chan khi sink do dung SINK_BLOCK.
+ * Message duoc format 1 lan cho moi format va dem tham chieu giua cac sink.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include "netlog_sink.h"
+
+#define SINK_MAX           8
+#define SINK_QUEUE_DEFAULT 1024
+#define SINK_BATCH         64
+#define SINK_LINE_MAX      1024
+#define SINK_RECONNECT_NS  1000000000ULL
+#define SINK_SNDTIMEO_MS   500
+#define SINK_STACK_SIZE    (64 * 1024)
+
+enum sink_kind {
+	SINK_STDOUT,
+	SINK_FILE,
+	SINK_UNIX,
+};
+
+struct sink_msg {
+	int refs;
+	unsigned int len;
+	char data[];
+};
+
+struct sink {
+	enum sink_kind kind;
+	enum sink_policy policy;
+	enum sink_format format;
+	char path[108];          /* sizeof(sun_path) */
+	int fd;
+	unsigned int sample_n;
+	unsigned int sample_ctr;
+	__u64 next_connect;
+
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t not_empty;
+	pthread_cond_t not_full;
+	struct sink_msg **q;
+	unsigned int cap, head, len;
+	int stopping;
+
+	/* Thong ke, chi doc sau khi thread da dung. */
+	__u64 written;
+	__u64 dropped;   /* do policy khi hang doi day */
+	__u64 lost;      /* loi ghi / socket mat ket noi */
+};
+
+/*
+ * Pool message co dinh (--mem-budget): cap phat 1 lan luc khoi dong, moi slot
+ * du cho 1 dong SINK_LINE_MAX. Khong co pool thi dung malloc/free.
+ */
+#define SINK_SLOT_SIZE ((sizeof(struct sink_msg) + SINK_LINE_MAX + 7) & ~7UL)
+
+static struct {
+	char *slots;
+	struct sink_msg **free;
+	unsigned int nr, nr_free;
+	pthread_mutex_t lock;
+} pool = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static struct sink sinks[SINK_MAX];
+static int nr_sinks;
+static sink_format_fn formatters[SINK_FMT_MAX];
+
+static const char *kind_name[] = {
+	[SINK_STDOUT] = "stdout",
+	[SINK_FILE]   = "file",
+	[SINK_UNIX]   = "unix",
+};
+
+static __u64 mono_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (__u64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void msg_put(struct sink_msg *m)
+{
+	if (__atomic_sub_fetch(&m->refs, 1, __ATOMIC_ACQ_REL))
+		return;
+	if (!pool.slots) {
+		free(m);
+		return;
+	}
+	pthread_mutex_lock(&pool.lock);
+	pool.free[pool.nr_free++] = m;
+	pthread_mutex_unlock(&pool.lock);
+}
+
+static int parse_opt(struct sink *s, const char *opt)
+{
+	if (!strcmp(opt, "policy=block")) {
+		s->policy = SINK_BLOCK;
+	} else if (!strcmp(opt, "policy=drop-newest")) {
+		s->policy = SINK_DROP_NEWEST;
+	} else if (!strcmp(opt, "policy=drop-oldest")) {
+		s->policy = SINK_DROP_OLDEST;
+	} else if (!strncmp(opt, "policy=sample:", 14)) {
+		s->policy = SINK_SAMPLE;
+		s->sample_n = strtoul(opt + 14, NULL, 0);
+		if (s->sample_n < 2)
+			return -EINVAL;
+	} else if (!strcmp(opt, "format=text")) {
+		s->format = SINK_FMT_TEXT;
+	} else if (!strcmp(opt, "format=json")) {
+		s->format = SINK_FMT_JSON;
+	} else if (!strncmp(opt, "queue=", 6)) {
+		s->cap = strtoul(opt + 6, NULL, 0);
+		if (!s->cap)
+			return -EINVAL;
+	} else {
+		return -EINVAL;
+	}
+	return 0;
+}
+
+int sink_add(const char *spec)
+{
+	char buf[256], *opt, *save;
+	struct sink *s;
+	size_t n;
+
+	if (nr_sinks == SINK_MAX) {
+		fprintf(stderr, "Loi: toi da %d output\n", SINK_MAX);
+		return -E2BIG;
+	}
+	if (strlen(spec) >= sizeof(buf))
+		return -ENAMETOOLONG;
+	strcpy(buf, spec);
+
+	s = &sinks[nr_sinks];
+	memset(s, 0, sizeof(*s));
+	s->fd = -1;
+	s->cap = SINK_QUEUE_DEFAULT;
+
+	opt = strtok_r(buf, ",", &save);
+	if (!opt)
+		goto bad;
+	if (!strcmp(opt, "stdout")) {
+		s->kind = SINK_STDOUT;
+	} else if (!strncmp(opt, "file:", 5) || !strncmp(opt, "unix:", 5)) {
+		s->kind = opt[0] == 'f' ? SINK_FILE : SINK_UNIX;
+		/* Sink file mac dinh block: file cham van nhanh hon socket, va
+		 * day la noi can du lieu day du nhat. */
+		s->policy = s->kind == SINK_FILE ? SINK_BLOCK : SINK_DROP_OLDEST;
+		n = strlen(opt + 5);
+		if (!n || n >= sizeof(s->path))
+			goto bad;
+		memcpy(s->path, opt + 5, n + 1);
+	} else {
+		goto bad;
+	}
+
+	while ((opt = strtok_r(NULL, ",", &save)))
+		if (parse_opt(s, opt))
+			goto bad;
+
+	nr_sinks++;
+	return 0;
+bad:
+	fprintf(stderr, "Loi: output khong hop le: '%s'\n", spec);
+	return -EINVAL;
+}
+
+int sinks_count(void)
+{
+	return nr_sinks;
+}
+
+static int sink_connect(struct sink *s)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	struct timeval tv = {
+		.tv_sec = SINK_SNDTIMEO_MS / 1000,
+		.tv_usec = SINK_SNDTIMEO_MS % 1000 * 1000,
+	};
+	int fd;
+
+	s->next_connect = mono_ns() + SINK_RECONNECT_NS;
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -errno;
+	/* Agent treo (khong doc socket) khong duoc giu thread ghi mai trong
+	 * writev, neu khong sinks_stop se treo o pthread_join: het han thi
+	 * writev tra EAGAIN, batch tinh la mat va socket duoc ket noi lai. */
+	if (setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv))) {
+		int err = -errno;
+
+		close(fd);
+		return err;
+	}
+	memcpy(addr.sun_path, s->path, sizeof(addr.sun_path));
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+		int err = -errno;
+
+		close(fd);
+		return err;
+	}
+	s->fd = fd;
+	return 0;
+}
+
+static int sink_open(struct sink *s)
+{
+	switch (s->kind) {
+	case SINK_STDOUT:
+		s->fd = STDOUT_FILENO;
+		return 0;
+	case SINK_FILE:
+		s->fd = open(s->path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+		return s->fd < 0 ? -errno : 0;
+	case SINK_UNIX:
+		/* Agent chua chay thi thread ghi se thu ket noi lai sau. */
+		sink_connect(s);
+		return 0;
+	}
+	return -EINVAL;
+}
+
+/* Ghi het iov, xu ly ghi thieu. Tra ve 0 hoac -errno. */
+static int write_iov(int fd, struct iovec *iov, int cnt)
+{
+	while (cnt) {
+		ssize_t n = writev(fd, iov, cnt);
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		while (cnt && (size_t)n >= iov->iov_len) {
+			n -= iov->iov_len;
+			iov++;
+			cnt--;
+		}
+		if (cnt) {
+			iov->iov_base = (char *)iov->iov_base + n;
+			iov->iov_len -= n;
+		}
+	}
+	return 0;
+}
+
+static void sink_write(struct sink *s, struct sink_msg **batch, int cnt)
+{
+	struct iovec iov[SINK_BATCH];
+	int i;
+
+	if (s->fd < 0 && (s->kind != SINK_UNIX || mono_ns() < s->next_connect ||
+			  sink_connect(s))) {
+		s->lost += cnt;
+		return;
+	}
+
+	for (i = 0; i < cnt; i++) {
+		iov[i].iov_base = batch[i]->data;
+		iov[i].iov_len = batch[i]->len;
+	}
+	if (write_iov(s->fd, iov, cnt)) {
+		s->lost += cnt;
+		/* Ke ca het han gui: stream co the da ghi do 1 dong, mo lai tu
+		 * dau (sau SINK_RECONNECT_NS) de agent khong nhan dong hong. */
+		if (s->kind == SINK_UNIX) {
+			close(s->fd);
+			s->fd = -1;
+			s->next_connect = mono_ns() + SINK_RECONNECT_NS;
+		}
+		return;
+	}
+	s->written += cnt;
+}
+
+static void *sink_thread(void *arg)
+{
+	struct sink_msg *batch[SINK_BATCH];
+	struct sink *s = arg;
+	int cnt, i;
+
+	for (;;) {
+		pthread_mutex_lock(&s->lock);
+		while (!s->len && !s->stopping)
+			pthread_cond_wait(&s->not_empty, &s->lock);
+		if (!s->len) {
+			pthread_mutex_unlock(&s->lock);
+			break;
+		}
+		for (cnt = 0; cnt < SINK_BATCH && s->len; cnt++) {
+			batch[cnt] = s->q[s->head];
+			s->head = (s->head + 1) % s->cap;
+			s->len--;
+		}
+		pthread_cond_signal(&s->not_full);
+		pthread_mutex_unlock(&s->lock);
+
+		sink_write(s, batch, cnt);
+		for (i = 0; i < cnt; i++)
+			msg_put(batch[i]);
+	}
+	return NULL;
+}
+
+static void sink_push(struct sink *s, struct sink_msg *m)
+{
+	struct sink_msg *old = NULL;
+
+	pthread_mutex_lock(&s->lock);
+	if (s->policy == SINK_SAMPLE && s->len >= s->cap / 2 &&
+	    s->sample_ctr++ % s->sample_n) {
+		s->dropped++;
+		goto unlock;
+	}
+	if (s->len == s->cap) {
+		switch (s->policy) {
+		case SINK_BLOCK:
+			while (s->len == s->cap)
+				pthread_cond_wait(&s->not_full, &s->lock);
+			break;
+		case SINK_DROP_OLDEST:
+			old = s->q[s->head];
+			s->head = (s->head + 1) % s->cap;
+			s->len--;
+			s->dropped++;
+			break;
+		default:
+			s->dropped++;
+			goto unlock;
+		}
+	}
+	__atomic_add_fetch(&m->refs, 1, __ATOMIC_RELAXED);
+	s->q[(s->head + s->len) % s->cap] = m;
+	s->len++;
+	pthread_cond_signal(&s->not_empty);
+unlock:
+	pthread_mutex_unlock(&s->lock);
+	if (old)
+		msg_put(old);
+}
+
+static struct sink_msg *msg_new(const char *data, unsigned int len)
+{
+	struct sink_msg *m = NULL;
+
+	if (!pool.slots) {
+		m = malloc(sizeof(*m) + len);
+	} else if (len <= SINK_LINE_MAX) {
+		pthread_mutex_lock(&pool.lock);
+		if (pool.nr_free)
+			m = pool.free[--pool.nr_free];
+		pthread_mutex_unlock(&pool.lock);
+	}
+	if (!m)
+		return NULL;
+	/* Giu 1 tham chieu cho nguoi tao, tha sau khi da day vao moi sink. */
+	m->refs = 1;
+	m->len = len;
+	memcpy(m->data, data, len);
+	return m;
+}
+
+size_t sinks_msg_size(void)
+{
+	return SINK_SLOT_SIZE + sizeof(struct sink_msg *);
+}
+
+int sinks_prealloc(unsigned int nr_msgs)
+{
+	unsigned int i;
+
+	pool.slots = calloc(nr_msgs, SINK_SLOT_SIZE);
+	pool.free = calloc(nr_msgs, sizeof(*pool.free));
+	if (!pool.slots || !pool.free) {
+		free(pool.slots);
+		free(pool.free);
+		pool.slots = NULL;
+		return -ENOMEM;
+	}
+	for (i = 0; i < nr_msgs; i++)
+		pool.free[i] = (struct sink_msg *)(pool.slots + i * SINK_SLOT_SIZE);
+	pool.nr = pool.nr_free = nr_msgs;
+
+	/* Hang doi dai hon pool cung khong bao gio day duoc. */
+	for (i = 0; i < (unsigned int)nr_sinks; i++)
+		if (sinks[i].cap > nr_msgs)
+			sinks[i].cap = nr_msgs;
+	return 0;
+}
+
+size_t sinks_mem_usage(void)
+{
+	size_t sz = pool.nr * sinks_msg_size();
+	int i;
+
+	for (i = 0; i < nr_sinks; i++)
+		sz += sinks[i].cap * sizeof(*sinks[i].q) + SINK_STACK_SIZE;
+	return sz;
+}
+
+int sinks_start(const sink_format_fn fmts[SINK_FMT_MAX], const char *header)
+{
+	struct sink_msg *hdr = NULL;
+	pthread_attr_t attr;
+	int i, err;
+
+	memcpy(formatters, fmts, sizeof(formatters));
+	/* Agent dong socket giua chung: nhan EPIPE thay vi bi kill. */
+	signal(SIGPIPE, SIG_IGN);
+
+	if (header) {
+		hdr = msg_new(header, strlen(header));
+		if (!hdr)
+			return -ENOMEM;
+	}
+
+	/* Thread ghi chi goi writev: stack nho de footprint (va mlock) du doan duoc. */
+	pthread_attr_init(&attr);
+	pthread_attr_setstacksize(&attr, SINK_STACK_SIZE);
+
+	for (i = 0; i < nr_sinks; i++) {
+		struct sink *s = &sinks[i];
+
+		s->q = calloc(s->cap, sizeof(*s->q));
+		if (!s->q) {
+			err = -ENOMEM;
+			goto fail;
+		}
+		err = sink_open(s);
+		if (err) {
+			fprintf(stderr, "Loi: khong mo duoc output %s:%s (%d)\n",
+				kind_name[s->kind], s->path, err);
+			goto fail;
+		}
+		pthread_mutex_init(&s->lock, NULL);
+		pthread_cond_init(&s->not_empty, NULL);
+		pthread_cond_init(&s->not_full, NULL);
+		if (hdr && s->format == SINK_FMT_TEXT)
+			sink_push(s, hdr);
+		err = -pthread_create(&s->thread, &attr, sink_thread, s);
+		if (err) {
+			/* Khong co thread de sinks_stop don: tra message da xep
+			 * hang (hdr), huy lock va dong output ngay tai day. */
+			for (; s->len; s->len--) {
+				msg_put(s->q[s->head]);
+				s->head = (s->head + 1) % s->cap;
+			}
+			pthread_cond_destroy(&s->not_full);
+			pthread_cond_destroy(&s->not_empty);
+			pthread_mutex_destroy(&s->lock);
+			if (s->fd >= 0 && s->kind != SINK_STDOUT)
+				close(s->fd);
+			s->fd = -1;
+			goto fail;
+		}
+	}
+	pthread_attr_destroy(&attr);
+	if (hdr)
+		msg_put(hdr);
+	return 0;
+
+fail:
+	pthread_attr_destroy(&attr);
+	/* Cac sink truoc i da co thread: dung lai tu te. */
+	free(sinks[i].q);
+	nr_sinks = i;
+	sinks_stop();
+	if (hdr)
+		msg_put(hdr);
+	return err;
+}
+
+void sinks_emit(const struct event *e)
+{
+	struct sink_msg *msgs[SINK_FMT_MAX] = {};
+	char line[SINK_LINE_MAX];
+	int i, len;
+
+	for (i = 0; i < nr_sinks; i++) {
+		struct sink *s = &sinks[i];
+		struct sink_msg **m = &msgs[s->format];
+
+		if (!*m) {
+			len = formatters[s->format](e, line, sizeof(line));
+			if (len < 0 || len >= (int)sizeof(line))
+				len = sizeof(line) - 1;
+			*m = msg_new(line, len);
+			if (!*m) {
+				__atomic_add_fetch(&s->lost, 1, __ATOMIC_RELAXED);
+				continue;
+			}
+		}
+		sink_push(s, *m);
+	}
+
+	for (i = 0; i < SINK_FMT_MAX; i++)
+		if (msgs[i])
+			msg_put(msgs[i]);
+}
+
+void sinks_stop(void)
+{
+	int i;
+
+	for (i = 0; i < nr_sinks; i++) {
+		struct sink *s = &sinks[i];
+
+		pthread_mutex_lock(&s->lock);
+		s->stopping = 1;
+		pthread_cond_signal(&s->not_empty);
+		pthread_mutex_unlock(&s->lock);
+		pthread_join(s->thread, NULL);
+
+		if (s->fd >= 0 && s->kind != SINK_STDOUT)
+			close(s->fd);
+		free(s->q);
+		if (s->dropped || s->lost)
+			fprintf(stderr, "output %s%s%s: ghi %llu, bo %llu (day), mat %llu (loi ghi)\n",
+				kind_name[s->kind], s->path[0] ? ":" : "", s->path,
+				(unsigned long long)s->written,
+				(unsigned long long)s->dropped,
+				(unsigned long long)s->lost);
+	}
+	nr_sinks = 0;
+
+	free(pool.slots);
+	free(pool.free);
+	pool.slots = NULL;
+	pool.nr = pool.nr_free = 0;
+}
@@ -0,0 +1,52 @@
+#ifndef __NETLOG_SINK_H
+#define __NETLOG_SINK_H
+
+#include <stddef.h>
+#include <linux/types.h>
+#include "netlog.h"
+
+/* Chinh sach khi hang doi cua mot sink day. */
+enum sink_policy {
+	SINK_BLOCK,        /* consumer cho (chi nen dung cho sink nhanh, vd file) */
+	SINK_DROP_NEWEST,  /* bo event moi */
+	SINK_DROP_OLDEST,  /* bo event cu nhat trong hang doi */
+	SINK_SAMPLE,       /* hang doi qua nua: giu 1/N, day han: bo event moi */
+};
+
+enum sink_format {
+	SINK_FMT_TEXT,
+	SINK_FMT_JSON,
+	SINK_FMT_MAX,
+};
+
+/* Format event vao buf, tra ve do dai (khong tinh '\0'). */
+typedef int (*sink_format_fn)(const struct event *e, char *buf, size_t size);
+
+/*
+ * spec: "stdout" | "file:PATH" | "unix:PATH", theo sau la cac tuy chon
+ * ",policy=block|drop-newest|drop-oldest|sample:N", ",format=text|json",
+ * ",queue=N". Goi truoc sinks_start().
+ */
+int sink_add(const char *spec);
+int sinks_count(void);
+
+/*
+ * --mem-budget: cap phat truoc nr_msgs message co dinh, sau do sinks_emit()
+ * khong malloc nua (pool het thi event bi tinh la mat). Goi sau sink_add(),
+ * truoc sinks_start(). sinks_msg_size() la chi phi cho moi message.
+ */
+int sinks_prealloc(unsigned int nr_msgs);
+size_t sinks_msg_size(void);
+/* Bo nho user-space cua lop sink: pool, hang doi, stack thread ghi. */
+size_t sinks_mem_usage(void);
+
+/* header (co the NULL) duoc gui dau tien toi cac sink format text. */
+int sinks_start(const sink_format_fn fmts[SINK_FMT_MAX], const char *header);
+
+/* Format event 1 lan cho moi format dang dung, chia se buffer giua cac sink. */
+void sinks_emit(const struct event *e);
+
+/* Ghi not phan con trong hang doi, dung thread, in thong ke ra stderr. */
+void sinks_stop(void);
+
+#endif /* __NETLOG_SINK_H */
@@ -0,0 +1,22 @@
+#ifndef __NETLOG_SNAP_H
+#define __NETLOG_SNAP_H
+
+#include <stdbool.h>
+#include <linux/types.h>
+#include "netlog.h"
+
+/*
+ * Snapshot cac socket TCP da co luc khoi dong, duoi dang struct event
+ * (kind = EVENT_SNAPSHOT). Goi fn cho moi socket; fn tra ve != 0 thi dung.
+ */
+typedef int (*snap_fn)(const struct event *e, void *ctx);
+
+/* Qua bpf_iter: prog_fd la program SEC("iter/tcp") da load (cold) hoac da pin
+ * (warm). Tra ve so socket, < 0 neu loi. */
+int snap_iter(int prog_fd, snap_fn fn, void *ctx);
+
+/* Kernel khong co iterator: parse /proc/net/tcp (va tcp6 neu ipv6). Khong co
+ * flow id, uid/dport chua loc. */
+int snap_proc(bool ipv6, snap_fn fn, void *ctx);
+
+#endif /* __NETLOG_SNAP_H */
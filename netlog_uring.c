@@ -0,0 +1,176 @@
+/*
+ * netlog_uring.c - io_uring qua syscall: setup, mmap SQ/CQ, writev, reap.
+ * Theo io_uring(7): tail cua SQ va head cua CQ do user-space ghi (release),
+ * head cua SQ va tail cua CQ do kernel ghi (acquire).
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include "netlog_uring.h"
+
+struct uring {
+	int fd;
+	bool fixed;
+	int file;
+	unsigned int *sq_head, *sq_tail, *sq_mask, *sq_array;
+	unsigned int *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	unsigned int sq_entries;
+	unsigned int to_submit;
+	void *sq_ring, *cq_ring;
+	size_t sq_ring_sz, cq_ring_sz, sqes_sz;
+};
+
+struct uring *uring_open(unsigned int entries)
+{
+	struct io_uring_params p = {};
+	struct uring *u;
+	__u8 *sq, *cq;
+	int err;
+
+	u = calloc(1, sizeof(*u));
+	if (!u)
+		return NULL;
+	u->fd = syscall(__NR_io_uring_setup, entries, &p);
+	if (u->fd < 0) {
+		err = errno;
+		free(u);
+		errno = err;
+		return NULL;
+	}
+
+	u->sq_ring_sz = p.sq_off.array + p.sq_entries * sizeof(__u32);
+	u->cq_ring_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (u->cq_ring_sz > u->sq_ring_sz)
+			u->sq_ring_sz = u->cq_ring_sz;
+		u->cq_ring_sz = 0;
+	}
+	sq = mmap(NULL, u->sq_ring_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		  u->fd, IORING_OFF_SQ_RING);
+	if (sq == MAP_FAILED)
+		goto fail;
+	u->sq_ring = sq;
+	cq = sq;
+	if (u->cq_ring_sz) {
+		cq = mmap(NULL, u->cq_ring_sz, PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+		if (cq == MAP_FAILED)
+			goto fail;
+		u->cq_ring = cq;
+	}
+	u->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+	u->sqes = mmap(NULL, u->sqes_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		       u->fd, IORING_OFF_SQES);
+	if (u->sqes == MAP_FAILED) {
+		u->sqes = NULL;
+		goto fail;
+	}
+
+	u->sq_head = (unsigned int *)(sq + p.sq_off.head);
+	u->sq_tail = (unsigned int *)(sq + p.sq_off.tail);
+	u->sq_mask = (unsigned int *)(sq + p.sq_off.ring_mask);
+	u->sq_array = (unsigned int *)(sq + p.sq_off.array);
+	u->cq_head = (unsigned int *)(cq + p.cq_off.head);
+	u->cq_tail = (unsigned int *)(cq + p.cq_off.tail);
+	u->cq_mask = (unsigned int *)(cq + p.cq_off.ring_mask);
+	u->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+	u->sq_entries = p.sq_entries;
+	return u;
+
+fail:
+	err = errno;
+	uring_close(u);
+	errno = err;
+	return NULL;
+}
+
+void uring_close(struct uring *u)
+{
+	if (!u)
+		return;
+	if (u->sqes)
+		munmap(u->sqes, u->sqes_sz);
+	if (u->cq_ring)
+		munmap(u->cq_ring, u->cq_ring_sz);
+	if (u->sq_ring)
+		munmap(u->sq_ring, u->sq_ring_sz);
+	close(u->fd);
+	free(u);
+}
+
+int uring_fd(const struct uring *u)
+{
+	return u->fd;
+}
+
+int uring_register_file(struct uring *u, int fd)
+{
+	if (syscall(__NR_io_uring_register, u->fd, IORING_REGISTER_FILES, &fd, 1) < 0) {
+		/* Van chay duoc, chi mat phan toi uu fd co dinh. */
+		u->fixed = false;
+		u->file = fd;
+		return -errno;
+	}
+	u->fixed = true;
+	u->file = 0;
+	return 0;
+}
+
+int uring_prep_writev(struct uring *u, const struct iovec *iov, unsigned int cnt,
+		      __u64 off, __u64 user_data)
+{
+	unsigned int tail = *u->sq_tail, head;
+	struct io_uring_sqe *sqe;
+
+	head = __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+	if (tail - head >= u->sq_entries)
+		return -EBUSY;
+
+	sqe = &u->sqes[tail & *u->sq_mask];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = IORING_OP_WRITEV;
+	sqe->flags = u->fixed ? IOSQE_FIXED_FILE : 0;
+	sqe->fd = u->file;
+	sqe->addr = (unsigned long)iov;
+	sqe->len = cnt;
+	sqe->off = off;
+	sqe->user_data = user_data;
+	u->sq_array[tail & *u->sq_mask] = tail & *u->sq_mask;
+	__atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	u->to_submit++;
+	return 0;
+}
+
+int uring_submit(struct uring *u, unsigned int wait_nr)
+{
+	int n;
+
+	if (!u->to_submit && !wait_nr)
+		return 0;
+	n = syscall(__NR_io_uring_enter, u->fd, u->to_submit, wait_nr,
+		    wait_nr ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+	if (n < 0)
+		return -errno;
+	u->to_submit -= n < (int)u->to_submit ? n : u->to_submit;
+	return n;
+}
+
+int uring_reap(struct uring *u, __u64 *user_data, int *res)
+{
+	unsigned int head = *u->cq_head;
+	struct io_uring_cqe *cqe;
+
+	if (head == __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE))
+		return 0;
+	cqe = &u->cqes[head & *u->cq_mask];
+	*user_data = cqe->user_data;
+	*res = cqe->res;
+	__atomic_store_n(u->cq_head, head + 1, __ATOMIC_RELEASE);
+	return 1;
+}
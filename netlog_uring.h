@@ -0,0 +1,33 @@
+#ifndef __NETLOG_URING_H
+#define __NETLOG_URING_H
+
+#include <stdbool.h>
+#include <sys/uio.h>
+#include <linux/types.h>
+
+/*
+ * io_uring toi thieu cho ghi output (chi writev), goi thang syscall de khong
+ * phu thuoc liburing (NDK khong co). Mot thread dung, khong khoa.
+ */
+struct uring;
+
+/* NULL + errno neu kernel/SELinux/seccomp khong cho dung io_uring. */
+struct uring *uring_open(unsigned int entries);
+void uring_close(struct uring *u);
+int uring_fd(const struct uring *u);
+
+/* fd dich cua moi writev, goi truoc uring_prep_writev(). Dang ky duoc (slot 0)
+ * thi SQE dung IOSQE_FIXED_FILE, kernel khong fget/fput moi lan; loi thi van
+ * ghi bang fd thuong va tra ve < 0. */
+int uring_register_file(struct uring *u, int fd);
+
+/* Them SQE writev vao SQ (chua submit), off = -1 cho fd khong seek duoc.
+ * iov phai con song toi khi co CQE. -EBUSY neu SQ day. */
+int uring_prep_writev(struct uring *u, const struct iovec *iov, unsigned int cnt,
+		      __u64 off, __u64 user_data);
+/* Submit moi SQE da prep, cho it nhat wait_nr CQE. */
+int uring_submit(struct uring *u, unsigned int wait_nr);
+/* Lay 1 CQE, tra ve 1 neu co, 0 neu CQ rong. */
+int uring_reap(struct uring *u, __u64 *user_data, int *res);
+
+#endif /* __NETLOG_URING_H */